@@ -0,0 +1,207 @@
+#ifndef _DOORANALYTICS_H_
+#define _DOORANALYTICS_H_
+
+#include "mbed.h"
+#include "JsonPayload.h"
+
+#define DOOR_HISTORY_SIZE  64
+#define DOOR_FLAP_MS       10000
+#define HOUR_MS            3600000UL
+
+/*
+ * Streaming sketch of the open durations: a fixed histogram over
+ * exponential-ish bounds (in seconds). Every bucket also keeps the smallest
+ * and largest value it got, percentiles are interpolated between those, so
+ * equal samples give back their exact value. Constant memory whatever the
+ * number of samples.
+ */
+class DurationSketch {
+public:
+    DurationSketch() {
+        reset();
+    }
+
+    void reset() {
+        memset(counts, 0, sizeof(counts));
+        memset(lows, 0, sizeof(lows));
+        memset(highs, 0, sizeof(highs));
+        total = 0;
+        maxS = 0;
+    }
+
+    void add(uint32_t s) {
+        uint32_t i = 0;
+        while (i < BUCKETS - 1 && s >= bound(i)) {
+            i++;
+        }
+        if (counts[i] == 0 || s < lows[i]) {
+            lows[i] = s;
+        }
+        if (s > highs[i]) {
+            highs[i] = s;
+        }
+        counts[i]++;
+        total++;
+        if (s > maxS) {
+            maxS = s;
+        }
+    }
+
+    // q in percent (0-100)
+    uint32_t percentile(uint32_t q) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint32_t rank = (total * q + 99) / 100;
+        if (rank == 0) {
+            rank = 1;
+        }
+        uint32_t seen = 0;
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            if (seen + counts[i] >= rank) {
+                // First sample of the bucket at lows[i], last one at highs[i]
+                if (counts[i] == 1) {
+                    return lows[i];
+                }
+                uint64_t span = highs[i] - lows[i];
+                return lows[i] + (uint32_t)(span * (rank - seen - 1) / (counts[i] - 1));
+            }
+            seen += counts[i];
+        }
+        return maxS;
+    }
+
+    uint32_t count() const { return total; }
+    uint32_t max() const { return maxS; }
+
+private:
+    static const uint32_t BUCKETS = 13;
+
+    // Upper bound (exclusive) of bucket i, the last one is open ended
+    static uint32_t bound(uint32_t i) {
+        static const uint32_t bounds[BUCKETS - 1] = {
+            1, 2, 5, 10, 20, 30, 60, 120, 300, 600, 1800, 3600
+        };
+        return bounds[i];
+    }
+
+    uint32_t counts[BUCKETS];
+    uint32_t lows[BUCKETS];
+    uint32_t highs[BUCKETS];
+    uint32_t total;
+    uint32_t maxS;
+};
+
+/*
+ * Incremental statistics over the door activity, fed with the debounced
+ * open/close edges (kernel ms timestamps). Everything is O(1) per edge,
+ * apart from opens_last_hour() which scans the fixed history ring.
+ */
+class DoorAnalytics {
+public:
+    DoorAnalytics(uint32_t leftOpenS) :
+        leftOpenMs(leftOpenS * 1000), count(0), next(0), isOpen(false),
+        openedMs(0), lastCloseMs(0), leftOpenReported(false),
+        periodOpens(0), periodFlaps(0), periodLeftOpen(0) {
+    }
+
+    void on_open(uint32_t ms) {
+        // A door reopened right after being closed is flapping
+        if (count && ms - lastCloseMs < DOOR_FLAP_MS) {
+            periodFlaps++;
+        }
+        isOpen = true;
+        openedMs = ms;
+        leftOpenReported = false;
+        history[next] = ms;
+        next = (next + 1) % DOOR_HISTORY_SIZE;
+        if (count < DOOR_HISTORY_SIZE) {
+            count++;
+        }
+        periodOpens++;
+    }
+
+    void on_close(uint32_t ms) {
+        if (!isOpen) {
+            return;
+        }
+        isOpen = false;
+        lastCloseMs = ms;
+        durations.add((ms - openedMs) / 1000);
+    }
+
+    // True once per opening, when the door has been open longer than the threshold
+    bool check_left_open(uint32_t nowMs) {
+        if (!isOpen || leftOpenReported || leftOpenMs == 0 || nowMs - openedMs < leftOpenMs) {
+            return false;
+        }
+        leftOpenReported = true;
+        periodLeftOpen++;
+        return true;
+    }
+
+    uint32_t open_for(uint32_t nowMs) const {
+        return isOpen ? (nowMs - openedMs) / 1000 : 0;
+    }
+
+    // Saturates at DOOR_HISTORY_SIZE: only the most recent openings are kept
+    uint32_t opens_last_hour(uint32_t nowMs) const {
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (nowMs - history[i] < HOUR_MS) {
+                n++;
+            }
+        }
+        return n;
+    }
+
+    // Append the statistics of the current period
+    void write_summary(JsonBuffer<EVENT_PAYLOAD_SIZE>& out, uint32_t nowMs) const {
+        out.literal(", \"summary\": { \"opens\": ");
+        out.number(periodOpens);
+        out.literal(", \"opens_hour\": ");
+        out.number(opens_last_hour(nowMs));
+        out.literal(", \"flaps\": ");
+        out.number(periodFlaps);
+        out.literal(", \"left_open\": ");
+        out.number(periodLeftOpen);
+        out.literal(", \"open_p50\": ");
+        out.number(durations.percentile(50));
+        out.literal(", \"open_p90\": ");
+        out.number(durations.percentile(90));
+        out.literal(", \"open_max\": ");
+        out.number(durations.max());
+        out.literal(", \"open_now\": ");
+        out.number(open_for(nowMs));
+        out.literal(" }");
+    }
+
+    // Start a new period, once its summary has been sent
+    void reset_period() {
+        durations.reset();
+        periodOpens = 0;
+        periodFlaps = 0;
+        periodLeftOpen = 0;
+    }
+
+private:
+    uint32_t leftOpenMs;
+
+    // Ring of the most recent opening times
+    uint32_t history[DOOR_HISTORY_SIZE];
+    uint32_t count;
+    uint32_t next;
+
+    bool isOpen;
+    uint32_t openedMs;
+    uint32_t lastCloseMs;
+    bool leftOpenReported;
+
+    // Reset by every summary
+    DurationSketch durations;
+    uint32_t periodOpens;
+    uint32_t periodFlaps;
+    uint32_t periodLeftOpen;
+};
+
+#endif // _DOORANALYTICS_H_
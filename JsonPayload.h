@@ -0,0 +1,158 @@
+#ifndef _JSONPAYLOAD_H_
+#define _JSONPAYLOAD_H_
+
+#include "mbed.h"
+#include "SensorEventRing.h"
+
+#define EVENT_PAYLOAD_SIZE 320
+
+/*
+ * Event payload schema: every key in output order, each one with its
+ * separator so that it is copied as a single literal whose length is known
+ * at compile time. Summaries add their own fields (see DoorAnalytics.h).
+ */
+static const char EVENT_KEY_PAYLOAD[] = "{ \"payload\": ";
+static const char EVENT_KEY_DEVICE[]  = ", \"device\": ";
+static const char EVENT_KEY_BOOT[]    = ", \"boot\": ";
+static const char EVENT_KEY_TS[]      = ", \"ts\": ";
+static const char EVENT_KEY_SEQ[]     = ", \"seq\": ";
+static const char EVENT_KEY_UPTIME[]  = ", \"uptime\": ";
+static const char EVENT_KEY_SENSOR[]  = ", \"sensor\": ";
+static const char EVENT_KEY_STATE[]   = ", \"state\": ";
+static const char EVENT_END[]         = " }";
+
+/*
+ * Fixed-capacity JSON text buffer, meant to live on the stack.
+ * Nothing is allocated: once the buffer is full further appends are dropped
+ * and ok() turns false.
+ */
+template <size_t N>
+class JsonBuffer {
+public:
+    JsonBuffer() : len(0), overflow(false) {
+        data[0] = '\0';
+    }
+
+    void raw(const char* s, size_t n) {
+        if (len + n >= N) {
+            overflow = true;
+            return;
+        }
+        memcpy(data + len, s, n);
+        len += n;
+        data[len] = '\0';
+    }
+
+    // String literals: the length is known at compile time
+    template <size_t L>
+    void literal(const char (&s)[L]) {
+        raw(s, L - 1);
+    }
+
+    void number(uint32_t v) {
+        char tmp[10];
+        size_t n = 0;
+        do {
+            tmp[sizeof(tmp) - 1 - n++] = '0' + (v % 10);
+            v /= 10;
+        } while (v);
+        raw(tmp + sizeof(tmp) - n, n);
+    }
+
+    // Quoted string, with '"' and '\' escaped and control characters dropped
+    void string(const char* s) {
+        literal("\"");
+        for (; *s; s++) {
+            if (*s == '"' || *s == '\\') {
+                char esc[2] = { '\\', *s };
+                raw(esc, 2);
+            } else if ((unsigned char)*s >= 0x20) {
+                raw(s, 1);
+            }
+        }
+        literal("\"");
+    }
+
+    const char* c_str() const { return data; }
+    size_t size() const { return len; }
+    bool ok() const { return !overflow; }
+
+private:
+    char data[N];
+    size_t len;
+    bool overflow;
+};
+
+/*
+ * Payload published for every sensor event:
+ *
+ *   { "payload": <twitter id>, "device": "<client id>", "boot": <boot id>,
+ *     "ts": <epoch s>, "seq": <n>, "uptime": <s>, "sensor": "door", "state": 1 }
+ *
+ * The keys come from the schema above, and the part that never changes
+ * (twitter, device and boot id) is rendered once by init().
+ * encode() only formats the per-event fields. Other messages (summaries,
+ * alerts) share the same header through begin() and end().
+ */
+class EventPayload {
+public:
+    EventPayload() : prefixLen(0) {
+    }
+
+    // The twitter id is kept unquoted, as the backend has always received it
+    bool init(const char* twitterId, const char* deviceId, uint32_t bootId) {
+        JsonBuffer<EVENT_PAYLOAD_SIZE> p;
+        p.literal(EVENT_KEY_PAYLOAD);
+        p.raw(twitterId, strlen(twitterId));
+        p.literal(EVENT_KEY_DEVICE);
+        p.string(deviceId);
+        p.literal(EVENT_KEY_BOOT);
+        p.number(bootId);
+        if (!p.ok()) {
+            return false;
+        }
+        memcpy(prefix, p.c_str(), p.size() + 1);
+        prefixLen = p.size();
+        return true;
+    }
+
+    void begin(JsonBuffer<EVENT_PAYLOAD_SIZE>& out, uint32_t seq, time_t ts, uint32_t uptime) const {
+        out.raw(prefix, prefixLen);
+        out.literal(EVENT_KEY_TS);
+        out.number((uint32_t)ts);
+        out.literal(EVENT_KEY_SEQ);
+        out.number(seq);
+        out.literal(EVENT_KEY_UPTIME);
+        out.number(uptime);
+    }
+
+    bool end(JsonBuffer<EVENT_PAYLOAD_SIZE>& out) const {
+        out.literal(EVENT_END);
+        return out.ok();
+    }
+
+    bool encode(JsonBuffer<EVENT_PAYLOAD_SIZE>& out, const SensorEvent& ev,
+                uint32_t seq, time_t ts, uint32_t uptime) const {
+        begin(out, seq, ts, uptime);
+        out.literal(EVENT_KEY_SENSOR);
+        out.string(sensor_name(ev.type));
+        out.literal(EVENT_KEY_STATE);
+        out.number(ev.state);
+        return end(out);
+    }
+
+    static const char* sensor_name(uint8_t type) {
+        switch (type) {
+        case SENSOR_DOOR:   return "door";
+        case SENSOR_BUTTON: return "button";
+        case SENSOR_RFID:   return "rfid";
+        default:            return "unknown";
+        }
+    }
+
+private:
+    char prefix[EVENT_PAYLOAD_SIZE];
+    size_t prefixLen;
+};
+
+#endif // _JSONPAYLOAD_H_
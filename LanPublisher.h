@@ -0,0 +1,276 @@
+#ifndef _LANPUBLISHER_H_
+#define _LANPUBLISHER_H_
+
+#include "mbed.h"
+#include "UDPSocket.h"
+
+/* How the LAN path is used, see "lan-mode" in mbed_app.json */
+#define LAN_MODE_OFF       0
+#define LAN_MODE_PARALLEL  1
+#define LAN_MODE_FALLBACK  2
+
+#define LAN_PENDING_SIZE   8
+
+// Devices (or boots of a device) the hub tells apart at once
+#define LAN_DEDUP_STREAMS  8
+#define LAN_DEVICE_SIZE    32
+
+/*
+ * Sliding window over the last 32 sequence numbers of one stream, to tell
+ * which ones were already seen. A seq more than the window behind the top
+ * means the stream restarted: the window starts over from it.
+ * Meant for the hub: the same message reaches it through the broker and
+ * through the LAN, in any order.
+ */
+class SeqWindow {
+public:
+    SeqWindow() : top(0), bits(0), empty(true) {
+    }
+
+    // Mark seq as seen, returns true if it already was
+    bool check_and_set(uint32_t seq) {
+        if (empty) {
+            empty = false;
+            top = seq;
+            bits = 1;
+            return false;
+        }
+        if (seq > top) {
+            uint32_t shift = seq - top;
+            bits = shift < 32 ? (bits << shift) | 1 : 1;
+            top = seq;
+            return false;
+        }
+        uint32_t age = top - seq;
+        if (age >= 32) {
+            top = seq;
+            bits = 1;
+            return false;
+        }
+        bool seen = bits & (1UL << age);
+        bits |= (1UL << age);
+        return seen;
+    }
+
+private:
+    uint32_t top;
+    uint32_t bits;
+    bool empty;
+};
+
+/*
+ * Read a number field of a payload, key being its name in quotes followed by
+ * ": " (see the schema in JsonPayload.h). Returns false if there is none.
+ */
+inline bool lan_payload_number(const char* payload, const char* key, uint32_t* value) {
+    const char* p = strstr(payload, key);
+    if (!p) {
+        return false;
+    }
+    p += strlen(key);
+    if (*p < '0' || *p > '9') {
+        return false;
+    }
+    *value = strtoul(p, NULL, 10);
+    return true;
+}
+
+inline bool lan_payload_seq(const char* payload, uint32_t* seq) {
+    return lan_payload_number(payload, "\"seq\": ", seq);
+}
+
+/*
+ * Copy the "device" string of a payload, still escaped, returns false if
+ * there is none or it doesn't fit.
+ */
+inline bool lan_payload_device(const char* payload, char* out, size_t size) {
+    static const char key[] = "\"device\": \"";
+    const char* p = strstr(payload, key);
+    if (!p) {
+        return false;
+    }
+    p += sizeof(key) - 1;
+    size_t len = 0;
+    for (; *p && *p != '"'; p++) {
+        // Keep escape sequences whole, an escaped quote is not the end
+        if (*p == '\\' && p[1]) {
+            if (len + 1 >= size) {
+                return false;
+            }
+            out[len++] = *p++;
+        }
+        if (len + 1 >= size) {
+            return false;
+        }
+        out[len++] = *p;
+    }
+    out[len] = '\0';
+    return *p == '"';
+}
+
+/*
+ * Hub side: keeps the first copy of every message, whichever path it came
+ * from. Sequence numbers only mean something within one stream, a boot of
+ * one device: every stream has its own window, keyed on the "device" and
+ * "boot" fields. When more streams show up than the table holds, the one
+ * heard from the longest ago is forgotten.
+ * Payloads without a sequence number are always kept.
+ */
+class LanDedup {
+public:
+    LanDedup() : duplicates(0), uses(0) {
+        for (int i = 0; i < LAN_DEDUP_STREAMS; i++) {
+            streams[i].used = false;
+        }
+    }
+
+    bool accept(const char* payload) {
+        uint32_t seq;
+        if (!lan_payload_seq(payload, &seq)) {
+            return true;
+        }
+        char device[LAN_DEVICE_SIZE];
+        if (!lan_payload_device(payload, device, sizeof(device))) {
+            device[0] = '\0';
+        }
+        uint32_t boot = 0;
+        lan_payload_number(payload, "\"boot\": ", &boot);
+
+        Stream& s = stream(device, boot);
+        if (s.window.check_and_set(seq)) {
+            duplicates++;
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t duplicate_count() const { return duplicates; }
+
+private:
+    struct Stream {
+        char device[LAN_DEVICE_SIZE];
+        uint32_t boot;
+        uint32_t lastUsed;
+        bool used;
+        SeqWindow window;
+    };
+
+    Stream& stream(const char* device, uint32_t boot) {
+        Stream* oldest = &streams[0];
+        for (int i = 0; i < LAN_DEDUP_STREAMS; i++) {
+            Stream& s = streams[i];
+            if (s.used && s.boot == boot && strcmp(s.device, device) == 0) {
+                s.lastUsed = ++uses;
+                return s;
+            }
+            if (!s.used || (oldest->used && s.lastUsed < oldest->lastUsed)) {
+                oldest = &s;
+            }
+        }
+        strcpy(oldest->device, device);
+        oldest->boot = boot;
+        oldest->lastUsed = ++uses;
+        oldest->used = true;
+        oldest->window = SeqWindow();
+        return *oldest;
+    }
+
+    Stream streams[LAN_DEDUP_STREAMS];
+    uint32_t duplicates;
+    uint32_t uses;
+};
+
+/*
+ * Secondary publish path to a hub on the same LAN: every message is sent as
+ * one UDP datagram to a multicast group. Messages that also went through the
+ * broker are told apart by the hub with LanDedup. The hub may answer "ack <seq>" to the sender, the time between send and
+ * first ack gives the end-to-end latency.
+ */
+class LanPublisher {
+public:
+    LanPublisher(NetworkInterface* aNetwork, const char* group, uint16_t port) :
+        network(aNetwork), address(group, port), sent(0), acked(0),
+        lastLatency(0), maxLatency(0), totalLatency(0) {
+        memset(pending, 0, sizeof(pending));
+    }
+
+    ~LanPublisher() {
+        socket.close();
+    }
+
+    int open() {
+        int ret = socket.open(network);
+        if (ret < 0) {
+            return ret;
+        }
+        // Acks are polled from the network loop
+        socket.set_blocking(false);
+        return 0;
+    }
+
+    int publish(uint32_t seq, const char* buf, size_t len, uint32_t nowMs) {
+        nsapi_size_or_error_t rc = socket.sendto(address, buf, len);
+        if (rc < 0) {
+            return rc;
+        }
+        Pending& p = pending[seq % LAN_PENDING_SIZE];
+        p.seq = seq;
+        p.sentMs = nowMs;
+        p.waiting = true;
+        sent++;
+        return 0;
+    }
+
+    // Read the acks received so far, never blocks
+    void poll(uint32_t nowMs) {
+        char buf[24];
+        SocketAddress from;
+        nsapi_size_or_error_t n;
+        while ((n = socket.recvfrom(&from, buf, sizeof(buf) - 1)) > 0) {
+            buf[n] = '\0';
+            if (strncmp(buf, "ack ", 4) != 0) {
+                continue;
+            }
+            uint32_t seq = strtoul(buf + 4, NULL, 10);
+            Pending& p = pending[seq % LAN_PENDING_SIZE];
+            // Late or repeated acks are ignored
+            if (!p.waiting || p.seq != seq) {
+                continue;
+            }
+            p.waiting = false;
+            lastLatency = nowMs - p.sentMs;
+            if (lastLatency > maxLatency) {
+                maxLatency = lastLatency;
+            }
+            totalLatency += lastLatency;
+            acked++;
+        }
+    }
+
+    uint32_t sent_count() const { return sent; }
+    uint32_t acked_count() const { return acked; }
+    uint32_t last_latency() const { return lastLatency; }
+    uint32_t max_latency() const { return maxLatency; }
+    uint32_t avg_latency() const { return acked ? totalLatency / acked : 0; }
+
+private:
+    struct Pending {
+        uint32_t seq;
+        uint32_t sentMs;
+        bool waiting;
+    };
+
+    NetworkInterface* network;
+    UDPSocket socket;
+    SocketAddress address;
+
+    Pending pending[LAN_PENDING_SIZE];
+
+    uint32_t sent;
+    uint32_t acked;
+    uint32_t lastLatency;
+    uint32_t maxLatency;
+    uint32_t totalLatency;
+};
+
+#endif // _LANPUBLISHER_H_
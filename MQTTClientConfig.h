@@ -0,0 +1,75 @@
+#ifndef _MQTTCLIENTCONFIG_H_
+#define _MQTTCLIENTCONFIG_H_
+
+#include "mbed.h"
+#include "MQTTNetwork.h"
+#include "MQTTmbed.h"
+#include "MQTTClient.h"
+#include "MQTT_server_setting.h"
+#include "JsonPayload.h"
+
+/*
+ * The client keeps one send and one receive buffer of MQTT_PACKET_SIZE bytes,
+ * so it is sized on the largest packet this firmware really sends instead of
+ * the library defaults.
+ */
+
+// Fixed header: 1 byte of type and up to 4 of remaining length
+#define MQTT_FIXED_HEADER_SIZE   5
+
+// PUBLISH at QoS0: topic length, topic (sizeof counts the '\0'), payload
+#define MQTT_PUBLISH_PACKET_SIZE (MQTT_FIXED_HEADER_SIZE + 2 + sizeof(MQTT_TOPIC_PUB) - 1 + EVENT_PAYLOAD_SIZE)
+
+// Protocol version sent in CONNECT: 3 is MQTT 3.1, 4 is MQTT 3.1.1
+#define MQTT_VERSION 3
+
+// CONNECT variable header: protocol name ("MQIsdp" in 3.1, "MQTT" in 3.1.1)
+// with its length, then level, flags and keep alive
+#define MQTT_CONNECT_HEADER_SIZE (MQTT_VERSION == 3 ? 12 : 10)
+
+// CONNECT: variable header, then client id, username and password
+#define MQTT_CONNECT_PACKET_SIZE (MQTT_FIXED_HEADER_SIZE + MQTT_CONNECT_HEADER_SIZE + \
+                                  2 + sizeof(MQTT_CLIENT_ID) - 1 + \
+                                  2 + sizeof(MQTT_USERNAME) - 1 + \
+                                  2 + sizeof(MQTT_PASSWORD) - 1)
+
+#define MQTT_PACKET_SIZE ((int)(MQTT_PUBLISH_PACKET_SIZE > MQTT_CONNECT_PACKET_SIZE ? \
+                                MQTT_PUBLISH_PACKET_SIZE : MQTT_CONNECT_PACKET_SIZE))
+
+// Only MQTT_TOPIC_SUB can ever have a handler
+#define MQTT_MESSAGE_HANDLERS 1
+
+typedef MQTT::Client<MQTTNetwork, Countdown, MQTT_PACKET_SIZE, MQTT_MESSAGE_HANDLERS> MQTTClient_t;
+
+/*
+ * The RAM and the time of this client are tracked by tests/host/bench_mqtt_client
+ * against a recorded baseline, which fails as soon as they grow.
+ */
+
+/*
+ * Count, average and maximum duration of a repeated call, in us.
+ */
+class CallCost {
+public:
+    CallCost() : count(0), total(0), maxUs(0) {
+    }
+
+    void add(uint32_t us) {
+        count++;
+        total += us;
+        if (us > maxUs) {
+            maxUs = us;
+        }
+    }
+
+    uint32_t calls() const { return count; }
+    uint32_t avg() const { return count ? (uint32_t)(total / count) : 0; }
+    uint32_t max() const { return maxUs; }
+
+private:
+    uint32_t count;
+    uint64_t total;
+    uint32_t maxUs;
+};
+
+#endif // _MQTTCLIENTCONFIG_H_
@@ -7,7 +7,10 @@
 
 class MQTTNetwork {
 public:
-    MQTTNetwork(NetworkInterface* aNetwork) : network(aNetwork) {
+    // connectTimeoutMs bounds every blocking step of connect(), the TLS
+    // handshake included; -1 waits forever
+    MQTTNetwork(NetworkInterface* aNetwork, int aConnectTimeoutMs = -1) :
+        network(aNetwork), connectTimeoutMs(aConnectTimeoutMs) {
         socket = new TLSSocket;
     }
 
@@ -28,15 +31,19 @@ public:
     }
 
     int write(unsigned char* buffer, int len, int timeout) {
-        // TODO: handle time out
+        socket->set_timeout(timeout);
         return socket->send(buffer, len);
     }
 
     int connect(const char* hostname, int port, const char *ssl_ca_pem = NULL,
             const char *ssl_cli_pem = NULL, const char *ssl_pk_pem = NULL) {
+        // A fresh socket for every attempt, a closed TLS socket can't be reopened
+        delete socket;
+        socket = new TLSSocket;
         int ret = socket->open(network);
         if(ret < 0)
             return ret;
+        socket->set_timeout(connectTimeoutMs);
         socket->set_root_ca_cert(ssl_ca_pem);
         socket->set_client_cert_key(ssl_cli_pem, ssl_pk_pem);
         return socket->connect(hostname, port);
@@ -48,6 +55,7 @@ public:
 
 private:
     NetworkInterface* network;
+    int connectTimeoutMs;
     TLSSocket* socket;
 };
 
@@ -0,0 +1,161 @@
+#ifndef _SENSOREVENTRING_H_
+#define _SENSOREVENTRING_H_
+
+#include "mbed.h"
+
+/*
+ * Kind of signal carried by a SensorEvent.
+ */
+typedef enum
+{
+  SENSOR_DOOR = 0,
+  SENSOR_BUTTON,
+  SENSOR_RFID,
+} SensorType_t;
+
+/*
+ * One timestamped sample coming from a sensor.
+ * The timestamp is the kernel tick count in ms, it can be read from ISR context
+ * (the RTC can't, time() takes a mutex).
+ */
+struct SensorEvent {
+    uint32_t ms;
+    uint8_t  type;
+    uint8_t  state;
+};
+
+/*
+ * Fixed-capacity, lock-free single-producer/single-consumer ring.
+ *
+ * The producer only writes head, the consumer only writes tail, so no lock is
+ * needed on a single core as long as there is only one producer at a time.
+ * Interrupt handlers at the same priority never preempt each other, so all of
+ * them together count as one producer; a thread that wants to push must do it
+ * with interrupts masked (see push_from_thread()).
+ *
+ * N must be a power of two: indexes run freely and are masked on access.
+ */
+template <typename T, uint32_t N>
+class SpscRing {
+public:
+    SpscRing() : head(0), tail(0), drops(0), maxUsed(0) {
+        MBED_STATIC_ASSERT((N & (N - 1)) == 0 && N > 0, "SpscRing size must be a power of two");
+    }
+
+    // Producer side. Returns false (and counts a drop) when the ring is full.
+    bool push(const T& item) {
+        uint32_t h = head;
+        uint32_t used = h - tail;
+        if (used >= N) {
+            drops++;
+            return false;
+        }
+        items[h & (N - 1)] = item;
+        // Make the item visible before publishing the new head
+        __DMB();
+        head = h + 1;
+        if (used + 1 > maxUsed) {
+            maxUsed = used + 1;
+        }
+        return true;
+    }
+
+    // Producer side, for callers running in thread context.
+    bool push_from_thread(const T& item) {
+        core_util_critical_section_enter();
+        bool ok = push(item);
+        core_util_critical_section_exit();
+        return ok;
+    }
+
+    // Consumer side. Returns false when the ring is empty.
+    bool pop(T& item) {
+        uint32_t t = tail;
+        if (t == head) {
+            return false;
+        }
+        // Read head before the item it guards
+        __DMB();
+        item = items[t & (N - 1)];
+        __DMB();
+        tail = t + 1;
+        return true;
+    }
+
+    uint32_t size() const { return head - tail; }
+    uint32_t capacity() const { return N; }
+    uint32_t dropped() const { return drops; }
+    uint32_t max_occupancy() const { return maxUsed; }
+
+private:
+    T items[N];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    // Producer-only counters
+    volatile uint32_t drops;
+    volatile uint32_t maxUsed;
+};
+
+/*
+ * Debounce of a contact on the event timestamps, never on the pin level:
+ * events may wait in the ring, and are judged on when they happened.
+ *
+ * An edge closer than holdMs to the last accepted one is bounce and is held
+ * back. If the contact settled on the held level, that level is accepted
+ * once holdMs went by, either by the next edge or by settle().
+ */
+class EdgeDebouncer {
+public:
+    EdgeDebouncer(uint32_t aHoldMs, uint8_t initialLevel) :
+        holdMs(aHoldMs), level(initialLevel), lastMs(0), started(false), pending(false) {
+    }
+
+    // Feed the edges in order, out[] receives the accepted ones (0 to 2)
+    int feed(const SensorEvent& ev, SensorEvent out[2]) {
+        int n = 0;
+        if (settle(ev.ms, out[n])) {
+            n++;
+        }
+        if (ev.state != level && (!started || ev.ms - lastMs >= holdMs)) {
+            accept(ev);
+            out[n++] = ev;
+        } else {
+            held = ev;
+            pending = true;
+        }
+        return n;
+    }
+
+    // No edge for a while: returns true if the held level is now accepted
+    bool settle(uint32_t nowMs, SensorEvent& out) {
+        if (!pending || nowMs - lastMs < holdMs) {
+            return false;
+        }
+        pending = false;
+        if (held.state == level) {
+            return false;
+        }
+        accept(held);
+        out = held;
+        return true;
+    }
+
+    uint8_t current() const { return level; }
+
+private:
+    void accept(const SensorEvent& ev) {
+        level = ev.state;
+        lastMs = ev.ms;
+        started = true;
+        pending = false;
+    }
+
+    uint32_t holdMs;
+    uint8_t level;
+    uint32_t lastMs;
+    bool started;
+    bool pending;
+    SensorEvent held;
+};
+
+#endif // _SENSOREVENTRING_H_
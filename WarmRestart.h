@@ -0,0 +1,151 @@
+#ifndef _WARMRESTART_H_
+#define _WARMRESTART_H_
+
+#include "mbed.h"
+#if DEVICE_WATCHDOG
+#include "hal/watchdog_api.h"
+#endif
+#if DEVICE_RESET_REASON
+#include "hal/reset_reason_api.h"
+#endif
+#if DEVICE_TRNG
+#include "hal/trng_api.h"
+#endif
+
+#define RETAINED_MAGIC 0x4D454D33  // "MEM3", change it when RetainedState changes
+
+/*
+ * State that survives a reset, so that the board can come back armed without
+ * the reconfiguration window, the config file and the NTP sync.
+ *
+ * It must live in a section the startup code doesn't zero (see
+ * RETAINED_SECTION). If the toolchain zeroes it anyway the magic check fails
+ * and the board simply does a cold boot.
+ */
+struct RetainedState {
+    uint32_t magic;
+    // Picked on every cold boot, when the sequence numbers restart from 0
+    uint32_t bootId;
+    uint32_t lastSeq;
+    uint8_t  alarmActive;
+    uint8_t  alarmArmed;
+    uint8_t  rtcValid;
+    // Sized for the longest WPA SSID and passphrase
+    char     ssid[33];
+    char     psw[64];
+    // Twitter IDs are at most 20 digits
+    char     id[32];
+    uint32_t crc;
+    // Set by reboot() to tell our own resets from the user's ones, outside
+    // the CRC: it is only trusted together with a valid snapshot
+    uint8_t  rebootRequested;
+};
+
+#define RETAINED_SECTION MBED_SECTION(".noinit")
+
+/*
+ * Hardware watchdog supervisor and access to the retained state.
+ */
+class WarmRestart {
+public:
+    WarmRestart(RetainedState& aState) : state(aState), invalid(false) {
+    }
+
+    // A snapshot is usable only if it is intact and the board was reset by
+    // the watchdog or by reboot(). Anything else (power on, brown out, reset
+    // button) means "cold boot", so that the reconfiguration window stays
+    // reachable.
+    bool can_warm_start() {
+#if DEVICE_RESET_REASON
+        reset_reason_t reason = hal_reset_reason_get();
+        hal_reset_reason_clear();
+        bool warm = (reason == RESET_REASON_WATCHDOG || reason == RESET_REASON_SOFTWARE);
+#else
+        // No way to tell a watchdog reset from the reset button: only trust
+        // the resets asked by reboot()
+        bool warm = state.rebootRequested;
+#endif
+        state.rebootRequested = 0;
+        return warm && state.magic == RETAINED_MAGIC && state.crc == compute_crc();
+    }
+
+    // Call after every change to the state. Once invalidated the snapshot is
+    // never sealed again until the next boot.
+    void seal() {
+        if (invalid) {
+            return;
+        }
+        state.magic = RETAINED_MAGIC;
+        state.crc = compute_crc();
+    }
+
+    void invalidate() {
+        invalid = true;
+        state.magic = 0;
+    }
+
+    RetainedState& get() {
+        return state;
+    }
+
+    // Random id for a cold boot, so that the messages of this boot are told
+    // apart from the previous ones, which had the same sequence numbers
+    static uint32_t new_boot_id() {
+        uint32_t id = 0;
+#if DEVICE_TRNG
+        trng_t trng;
+        size_t len = 0;
+        trng_init(&trng);
+        trng_get_bytes(&trng, (uint8_t*)&id, sizeof(id), &len);
+        trng_free(&trng);
+#endif
+        // No TRNG: the RTC and the time spent in the boot sequence are
+        // unlikely to repeat
+        if (id == 0) {
+            id = (uint32_t)time(NULL) ^ us_ticker_read();
+        }
+        return id;
+    }
+
+    static void start_watchdog(uint32_t timeoutMs) {
+#if DEVICE_WATCHDOG
+        watchdog_config_t config;
+        config.timeout_ms = timeoutMs;
+        if (hal_watchdog_init(&config) != WATCHDOG_STATUS_OK) {
+            printf("ERROR: watchdog init failed\r\n");
+        }
+#else
+        (void)timeoutMs;
+        printf("No hardware watchdog on this target\r\n");
+#endif
+    }
+
+    static void kick() {
+#if DEVICE_WATCHDOG
+        hal_watchdog_kick();
+#endif
+    }
+
+    // Reboot now, the rest of the retained state must already be sealed
+    void reboot(const char* why) {
+        printf("Restarting: %s\r\n", why);
+        fflush(stdout);
+        seal();
+        state.rebootRequested = 1;
+        system_reset();
+    }
+
+private:
+    uint32_t compute_crc() const {
+        MbedCRC<POLY_32BIT_ANSI, 32> ct;
+        uint32_t crc = 0;
+        ct.compute((void*)&state, offsetof(RetainedState, crc), &crc);
+        return crc;
+    }
+
+    RetainedState& state;
+    // Set when the flash was erased: the cached configuration is stale
+    bool invalid;
+};
+
+#endif // _WARMRESTART_H_
@@ -20,13 +20,15 @@
 
 #include "mbed.h"
 #include "NTPClient.h"
-#include "MQTTNetwork.h"
-#include "MQTTmbed.h"
-#include "MQTTClient.h"
-#include "MQTT_server_setting.h"
+#include "MQTTClientConfig.h"
 #include "mbed_events.h"
 #include "mbedtls/error.h"
 #include "MFRC522.h"
+#include "SensorEventRing.h"
+#include "JsonPayload.h"
+#include "DoorAnalytics.h"
+#include "WarmRestart.h"
+#include "LanPublisher.h"
 
 #include "BlockDevice.h"
 #include "LittleFileSystem.h"
@@ -43,6 +45,42 @@
 #define WIFI_READ_TIMEOUT  10000
 #define PORT           80
 
+/* Sensor events -------------------------------------------------------------*/
+#define EVENT_RING_SIZE    32
+#define NETWORK_YIELD_MS   100
+// The TLS handshake runs in the network thread, the default stack is too small
+#define NETWORK_STACK_SIZE 8192
+// The event thread wakes up on every event, and at least this often for the
+// debounce, the LAN acks and the analytics
+#define EVENT_POLL_MS      100
+
+// Door contact bounce, see EdgeDebouncer
+#define DOOR_DEBOUNCE_MS   50
+
+// While publishing on the LAN only, retry the cloud broker this often
+#define CLOUD_RETRY_MS     60000
+
+// MQTT commands give up well before the watchdog fires
+#define MQTT_COMMAND_TIMEOUT_MS 10000
+// And so does every step of the TCP and TLS connection
+#define MQTT_CONNECT_TIMEOUT_MS 10000
+
+// A cloud publish slower than this also goes on the LAN, see mbed_app.json
+#define LAN_FALLBACK_MS    MBED_CONF_APP_LAN_FALLBACK_MS
+
+// Reset the board if the supervisor stops kicking the watchdog
+#define WATCHDOG_TIMEOUT_MS MBED_CONF_APP_WATCHDOG_TIMEOUT_MS
+
+// A Wi-Fi join may outlast the watchdog: the network thread is only declared
+// stuck after this long
+#define NETWORK_STALL_MS   120000
+
+// Print the runtime costs this often, not only when the client disconnects
+#define COST_REPORT_MS     600000
+
+// Door statistics, see mbed_app.json
+#define SUMMARY_PERIOD_MS  (MBED_CONF_APP_SUMMARY_PERIOD_S * 1000UL)
+
 /* Private typedef------------------------------------------------------------*/
 typedef enum
 {
@@ -74,16 +112,87 @@ LittleFileSystem fs("fs");
 //Construct MFRC Object
 MFRC522    RfChip   (SPI_MOSI, SPI_MISO, SPI_SCK, SPI_CS, MF_RESET);
 
-// An event queue is a very useful structure to debounce information between contexts (e.g. ISR and normal threads)
-// This is great because things such as network operations are illegal in ISR, so updating a resource in a button's fall() function is not allowed
-EventQueue eventQueue;
-Thread thread1;
+//Door magnetic sensor and alert LED
+InterruptIn doorSensor(D1);
+DigitalOut  led(LED2);
+
+// Every sensor signal (door, button, RFID) goes through this ring: it is filled from
+// interrupt context and drained by the event thread, since network operations are
+// illegal in ISR
+SpscRing<SensorEvent, EVENT_RING_SIZE> sensorEvents;
+// Released with every event pushed in the ring
+Semaphore eventWakeup(0, 1);
+// Alarm and publishing: started before any network operation, so that the
+// board is armed whether the network comes up or not
+Thread eventThread;
+// Wi-Fi, NTP, LAN socket and MQTT session, brought up in the background
+Thread networkThread(osPriorityNormal, NETWORK_STACK_SIZE);
+
+//Set up by the network thread, used by the event thread once cloudUp is set
+NetworkInterface* network = NULL;
+MQTTNetwork* mqttNetwork = NULL;
+MQTTClient_t* mqttClient = NULL;
+//Held around every call on mqttClient: the event thread publishes while the
+//network thread yields
+Mutex mqttMutex;
+// Wall time spent in publish(), see report_costs(). The cost of yield() is
+// measured on the host by tests/host/bench_mqtt_client.
+CallCost publishCost;
+EventPayload eventPayload;
+DoorAnalytics doorAnalytics(MBED_CONF_APP_DOOR_LEFT_OPEN_S);
+//Set by the network thread once the socket is open, never changed after
+LanPublisher* volatile lanPublisher = NULL;
+volatile bool cloudUp = false;
+uint32_t cloudDownMs = 0;
+//Set by the network thread once NTP answered, kept by save_state()
+volatile bool rtcSynced = false;
+volatile bool alarmActive = false;
+volatile bool networkRunning = false;
+// Set by the two threads on every loop, checked by the watchdog supervisor
+volatile bool eventAlive = false;
+volatile bool networkAlive = false;
+// Cleared while the alarm is on, set again once the door is closed
+bool alarmArmed = true;
+
+// Survives resets, see WarmRestart.h
+RetainedState retainedState RETAINED_SECTION;
+WarmRestart warmRestart(retainedState);
+
+
+/*
+ * Push a sensor event in the ring. Must run in interrupt context, or with
+ * interrupts masked (see SpscRing::push_from_thread()).
+ */
+static void post_event(uint8_t type, uint8_t state)
+{
+    SensorEvent ev;
+    ev.ms = (uint32_t)Kernel::get_ms_count();
+    ev.type = type;
+    ev.state = state;
+    sensorEvents.push(ev);
+    eventWakeup.release();
+}
+
+void door_rise_handler() {
+    post_event(SENSOR_DOOR, 1);
+}
+
+void door_fall_handler() {
+    post_event(SENSOR_DOOR, 0);
+}
+
+void btn1_fall_handler() {
+    post_event(SENSOR_BUTTON, 1);
+}
 
 
 /*
  * Callback function called when the button1 (blue) is clicked.
  */
 void btn1_rise_handler() {
+    // The cached configuration must not outlive the erase
+    warmRestart.invalidate();
+
     printf("Initializing the block device... ");
     fflush(stdout);
     int err = bd->init();
@@ -94,7 +203,12 @@ void btn1_rise_handler() {
 
     printf("Erasing the block device... ");
     fflush(stdout);
-    err = bd->erase(0, bd->size());
+    // One erase unit at a time: a whole-chip erase can outlast the watchdog
+    bd_size_t unit = bd->get_erase_size();
+    for (bd_addr_t addr = 0; !err && addr < bd->size(); addr += unit) {
+        err = bd->erase(addr, unit);
+        WarmRestart::kick();
+    }
     printf("%s\n", (err ? "Fail :(" : "OK"));
     if (err) {
         error("error: %s (%d)\n", strerror(-err), err);
@@ -318,30 +432,499 @@ static WIFI_Status_t SendWebPage()
 }
 
 
+//############################# EVENT THREAD ###################################
 
-//################################# MAIN #######################################
+//One sequence number per message
+static uint32_t publishSeq = 0;
 
+//Snapshot what a warm restart needs to come back armed
+static void save_state()
+{
+    RetainedState& rs = warmRestart.get();
+    rs.lastSeq = publishSeq;
+    rs.alarmActive = alarmActive;
+    rs.alarmArmed = alarmArmed;
+    rs.rtcValid = rtcSynced;
+    warmRestart.seal();
+}
 
-int main(int argc, char* argv[])
+//Set when the last cloud publish failed or took longer than LAN_FALLBACK_MS
+static bool cloudSlow = false;
+
+//Same seq on both paths, the hub keeps the first copy it gets (see LanDedup)
+static bool lan_publish(const JsonBuffer<EVENT_PAYLOAD_SIZE>& buf, uint32_t seq)
 {
+    int ret = lanPublisher->publish(seq, buf.c_str(), buf.size(), (uint32_t)Kernel::get_ms_count());
+    if(ret < 0) {
+        pc.printf("ERROR: LAN publish returned %d\r\n", ret);
+    }
+    return ret >= 0;
+}
 
-//##################### INIT SENSORS AND FILESYSTEM ############################
+//Nothing can be published before the network thread brought up a path
+static bool can_publish()
+{
+    return cloudUp || lanPublisher;
+}
 
-    RfChip.PCD_Init();
+//Send one JSON message on the publish topic, false if it went nowhere
+static bool publish_json(const JsonBuffer<EVENT_PAYLOAD_SIZE>& buf, uint32_t seq)
+{
+    // Never reuse a sequence number, even if the publish crashes the board
+    save_state();
+
+    MQTT::Message message;
+    message.retained = false;
+    message.dup = false;
+    message.qos = MQTT::QOS0;
+    message.id = (unsigned short)seq;
+    message.payload = (void*)buf.c_str();
+    message.payloadlen = buf.size();
+
+    // The LAN copy goes first when the cloud is not to be trusted: down, or
+    // too slow on the previous message
+    bool lanFirst = lanPublisher && (MBED_CONF_APP_LAN_MODE == LAN_MODE_PARALLEL ||
+                                     !cloudUp || cloudSlow);
+    bool sent = false;
+    if(lanFirst) {
+        sent = lan_publish(buf, seq);
+    }
 
-    bool isSubscribed = false;
+    // Publish a message. The network thread may drop the session in the
+    // meantime: cloudUp is only trusted under the mutex
+    bool lanAfter = false;
+    mqttMutex.lock();
+    if(cloudUp) {
+        pc.printf("Publishing message.\r\n");
+        Timer t;
+        t.start();
+        int rc = mqttClient->publish(MQTT_TOPIC_PUB, message);
+        uint32_t us = t.read_us();
+        publishCost.add(us);
+        if(rc != MQTT::SUCCESS) {
+            pc.printf("ERROR: rc from MQTT publish is %d\r\n", rc);
+        }
+        pc.printf("Message published.\r\n");
+        cloudSlow = (rc != MQTT::SUCCESS || us > LAN_FALLBACK_MS * 1000UL);
+        sent |= (rc == MQTT::SUCCESS);
+        lanAfter = cloudSlow && lanPublisher && !lanFirst;
+    }
+    mqttMutex.unlock();
+    if(lanAfter) {
+        sent |= lan_publish(buf, seq);
+    }
+    return sent;
+}
 
+//Keep publishing on the LAN, if any, while the cloud broker is unreachable
+static void cloud_down(const char* why)
+{
+    pc.printf("%s, %s\r\n", why, lanPublisher ? "publishing on the LAN only" : "alerts wait for the connection");
+    mqttMutex.lock();
+    cloudUp = false;
+    mqttMutex.unlock();
+    cloudDownMs = (uint32_t)Kernel::get_ms_count();
+}
 
-    //INIT PINs and LED
-    DigitalIn  doorSensor(D1);
-    DigitalOut led(LED2);
-    led = 0;
+//Open the TLS connection and the MQTT session, in the network thread. Runs
+//while cloudUp is false: the event thread leaves the client alone.
+static int cloud_connect()
+{
+    // Drop what is left of the previous session
+    if(mqttClient->isConnected())
+        mqttClient->disconnect();
+    mqttNetwork->disconnect();
 
-    //Set magnetic sensor in PullUp mode
-    doorSensor.mode(PullUp);
-    pc.printf("Pull up mode setted\n");
+    pc.printf("Connecting to host %s:%d ...\r\n", MQTT_SERVER_HOST_NAME, MQTT_SERVER_PORT);
+    int rc = mqttNetwork->connect(MQTT_SERVER_HOST_NAME, MQTT_SERVER_PORT, SSL_CA_PEM,
+            SSL_CLIENT_CERT_PEM, SSL_CLIENT_PRIVATE_KEY_PEM);
+    if (rc != MQTT::SUCCESS){
+        const int MAX_TLS_ERROR_CODE = -0x1000;
+        // Network error
+        if((MAX_TLS_ERROR_CODE < rc) && (rc < 0)) {
+            pc.printf("ERROR from MQTTNetwork connect is %d.", rc);
+        }
+        // TLS error - mbedTLS error codes starts from -0x1000 to -0x8000.
+        if(rc <= MAX_TLS_ERROR_CODE) {
+            const int buf_size = 256;
+            char *buf = new char[buf_size];
+            mbedtls_strerror(rc, buf, buf_size);
+            pc.printf("TLS ERROR (%d) : %s\r\n", rc, buf);
+            delete[] buf;
+        }
+        return rc;
+    }
+    pc.printf("Connection established.\r\n");
+    pc.printf("\r\n");
+
+
+    pc.printf("MQTT client is trying to connect the server ...\r\n");
+
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.MQTTVersion = MQTT_VERSION;
+    data.clientID.cstring = (char *)MQTT_CLIENT_ID;
+    data.username.cstring = (char *)MQTT_USERNAME;
+    data.password.cstring = (char *)MQTT_PASSWORD;
+
+    rc = mqttClient->connect(data);
+    if (rc != MQTT::SUCCESS) {
+        pc.printf("ERROR: rc from MQTT connect is %d\r\n", rc);
+        return rc;
+    }
+    pc.printf("Client connected.\r\n");
+    pc.printf("\r\n");
+    cloudSlow = false;
+    cloudUp = true;
+    return MQTT::SUCCESS;
+}
+
+//Alerts raised while nothing could be published, sent once a path is up.
+//Only used by the event thread.
+static SpscRing<SensorEvent, 4> unsentAlerts;
+
+static void keep_alert(const SensorEvent& ev)
+{
+    if(!unsentAlerts.push(ev)) {
+        pc.printf("ERROR: alert dropped, no connection\r\n");
+    }
+}
+
+//Publish the door alert, or keep it until it can be
+static void publish_alert(const SensorEvent& ev)
+{
+    if(!can_publish()) {
+        keep_alert(ev);
+        return;
+    }
+
+    // The event may have waited in the ring: date it back to when it happened
+    uint32_t nowMs = (uint32_t)Kernel::get_ms_count();
+    time_t ts = time(NULL) - (nowMs - ev.ms) / 1000;
+
+    JsonBuffer<EVENT_PAYLOAD_SIZE> buf;
+    uint32_t seq = publishSeq;
+    if(!eventPayload.encode(buf, ev, seq, ts, nowMs / 1000)) {
+        pc.printf("ERROR: payload exceeds %d bytes\r\n", EVENT_PAYLOAD_SIZE);
+        return;
+    }
+    publishSeq++;
+    if(!publish_json(buf, seq)) {
+        keep_alert(ev);
+    }
+}
+
+//Publish the alerts kept while nothing was up
+static void flush_alerts()
+{
+    SensorEvent ev;
+    // Bounded: an alert that fails again goes back in the queue
+    for(uint32_t n = unsentAlerts.size(); n > 0 && can_publish() && unsentAlerts.pop(ev); n--) {
+        publish_alert(ev);
+    }
+}
+
+//Publish the door statistics collected since the last summary
+static void publish_summary(uint32_t nowMs)
+{
+    if(!can_publish()) {
+        // Keep the statistics, they go in the next summary
+        return;
+    }
+
+    JsonBuffer<EVENT_PAYLOAD_SIZE> buf;
+    uint32_t seq = publishSeq;
+    eventPayload.begin(buf, seq, time(NULL), nowMs / 1000);
+    doorAnalytics.write_summary(buf, nowMs);
+    if(!eventPayload.end(buf)) {
+        // Keep the statistics, they go in the next summary
+        pc.printf("ERROR: payload exceeds %d bytes\r\n", EVENT_PAYLOAD_SIZE);
+        return;
+    }
+    doorAnalytics.reset_period();
+    publishSeq++;
+    publish_json(buf, seq);
+}
+
+//Publish the "door left open" alert
+static void publish_left_open(uint32_t nowMs)
+{
+    if(!can_publish()) {
+        pc.printf("ERROR: left open alert dropped, no connection\r\n");
+        return;
+    }
+
+    JsonBuffer<EVENT_PAYLOAD_SIZE> buf;
+    uint32_t seq = publishSeq;
+    eventPayload.begin(buf, seq, time(NULL), nowMs / 1000);
+    buf.literal(EVENT_KEY_SENSOR);
+    buf.string(EventPayload::sensor_name(SENSOR_DOOR));
+    buf.literal(", \"left_open\": ");
+    buf.number(doorAnalytics.open_for(nowMs));
+    if(!eventPayload.end(buf)) {
+        pc.printf("ERROR: payload exceeds %d bytes\r\n", EVENT_PAYLOAD_SIZE);
+        return;
+    }
+    publishSeq++;
+    publish_json(buf, seq);
+}
+
+//Periodic work of the analytics stage
+static void run_analytics(uint32_t nowMs)
+{
+    static uint32_t lastSummaryMs = nowMs;
 
+    if(doorAnalytics.check_left_open(nowMs)) {
+        pc.printf("Door left open for %lu s\r\n", (unsigned long)doorAnalytics.open_for(nowMs));
+        publish_left_open(nowMs);
+    }
+    if(SUMMARY_PERIOD_MS && nowMs - lastSummaryMs >= SUMMARY_PERIOD_MS) {
+        publish_summary(nowMs);
+        lastSummaryMs = nowMs;
+    }
+}
+
+//Door level as seen through the debouncer, closed at boot: a door already
+//open is queued as an opening by main()
+static EdgeDebouncer doorDebounce(DOOR_DEBOUNCE_MS, 0);
+
+//Run the alarm state machine on one debounced door edge
+static void handle_door(const SensorEvent& ev)
+{
+    if(ev.state) {
+        doorAnalytics.on_open(ev.ms);
+    } else {
+        doorAnalytics.on_close(ev.ms);
+    }
+
+    if(ev.state == 1 && alarmArmed) {
+        //START LED ALERT (A SOUND ALERT COULD BE IMPLEMENTED AS WELL)
+        led = 1;
+        alarmArmed = false;
+        alarmActive = true;
+        // With summaries enabled raw door events are not forwarded
+        if(!SUMMARY_PERIOD_MS) {
+            publish_alert(ev);
+        }
+        pc.printf("Wait alert to stop\n");
+    } else if(ev.state == 0 && !alarmActive && !alarmArmed) {
+        pc.printf("Door closed, alarm armed\n");
+        alarmArmed = true;
+    }
+}
+
+//Run the alarm state machine on one event coming from the ring
+static void handle_event(const SensorEvent& ev)
+{
+    switch(ev.type)
+    {
+    case SENSOR_DOOR: {
+        // Judged on the edge timestamps: a door opened and closed while this
+        // thread was busy still raises the alarm
+        SensorEvent edges[2];
+        int n = doorDebounce.feed(ev, edges);
+        for(int i = 0; i < n; i++) {
+            handle_door(edges[i]);
+        }
+        break;
+    }
+
+    case SENSOR_RFID:
+        if(alarmActive) {
+            pc.printf("Alert stopped\n");
+            led = 0;
+            alarmActive = false;
+            //Wait until door is closed before restarting alarm
+            alarmArmed = (doorDebounce.current() == 0);
+            if(!alarmArmed) {
+                pc.printf("Wait door to be closed again\n");
+            }
+        }
+        break;
+
+    case SENSOR_BUTTON:
+        btn1_rise_handler();
+        break;
+
+    default:
+        break;
+    }
+}
+
+//Ring, MQTT and LAN figures since boot
+static void report_costs()
+{
+    pc.printf("Sensor events: %lu dropped, max occupancy %lu/%lu\r\n",
+              (unsigned long)sensorEvents.dropped(), (unsigned long)sensorEvents.max_occupancy(),
+              (unsigned long)sensorEvents.capacity());
+    pc.printf("MQTT publish: %lu calls, avg %lu us, max %lu us\r\n",
+              (unsigned long)publishCost.calls(), (unsigned long)publishCost.avg(), (unsigned long)publishCost.max());
+    if(lanPublisher) {
+        pc.printf("LAN: %lu sent, %lu acked, latency avg %lu ms max %lu ms\r\n",
+                  (unsigned long)lanPublisher->sent_count(),
+                  (unsigned long)lanPublisher->acked_count(), (unsigned long)lanPublisher->avg_latency(),
+                  (unsigned long)lanPublisher->max_latency());
+    }
+}
+
+//Drain the sensor ring and run the alarm, with or without network
+static void event_thread()
+{
+    SensorEvent ev;
+    uint32_t lastReportMs = (uint32_t)Kernel::get_ms_count();
 
+    while(1) {
+        eventWakeup.wait(EVENT_POLL_MS);
+        if(lanPublisher) {
+            uint32_t acked = lanPublisher->acked_count();
+            lanPublisher->poll((uint32_t)Kernel::get_ms_count());
+            if(lanPublisher->acked_count() != acked) {
+                pc.printf("LAN ack after %lu ms\r\n", (unsigned long)lanPublisher->last_latency());
+            }
+        }
+        while(sensorEvents.pop(ev)) {
+            handle_event(ev);
+        }
+        uint32_t nowMs = (uint32_t)Kernel::get_ms_count();
+        if(doorDebounce.settle(nowMs, ev)) {
+            handle_door(ev);
+        }
+        flush_alerts();
+        run_analytics(nowMs);
+        if(nowMs - lastReportMs >= COST_REPORT_MS) {
+            lastReportMs = nowMs;
+            report_costs();
+        }
+        save_state();
+        eventAlive = true;
+    }
+}
+
+
+//############################# NETWORK THREAD #################################
+
+//Join the configured access point, false if it failed
+static bool network_join()
+{
+    RetainedState& rs = warmRestart.get();
+    nsapi_error_t ret;
+    WiFiInterface *wifi = network->wifiInterface();
+    if (wifi) {
+        printf("This is a Wi-Fi board\n");
+        ret = wifi->connect(rs.ssid, rs.psw, NSAPI_SECURITY_WPA_WPA2, 0);
+    } else {
+        ret = network->connect();
+    }
+    if (ret && ret != NSAPI_ERROR_IS_CONNECTED) {
+        printf("Unable to connect! returned %d\n", ret);
+        return false;
+    }
+    printf("Connected to network\n");
+    return true;
+}
+
+//Sync the real time clock (RTC), it keeps running across a warm restart
+static void sync_clock()
+{
+    NTPClient ntp(network);
+    ntp.set_server("time.google.com", 123);
+    time_t now = ntp.get_timestamp();
+    if (now > 0) {
+        set_time(now);
+        rtcSynced = true;
+    }
+    now = time(NULL);
+    pc.printf("Time is now %s", ctime(&now));
+}
+
+//Open the LAN socket, the event thread publishes on it from then on
+static void open_lan()
+{
+    LanPublisher* lan = new LanPublisher(network, MBED_CONF_APP_LAN_GROUP, MBED_CONF_APP_LAN_PORT);
+    if(lan->open() < 0) {
+        pc.printf("ERROR: cannot open the LAN socket\r\n");
+        delete lan;
+        return;
+    }
+    pc.printf("Publishing on the LAN to %s:%d\r\n", MBED_CONF_APP_LAN_GROUP, MBED_CONF_APP_LAN_PORT);
+    lanPublisher = lan;
+}
+
+//One attempt at bringing up what is still down: the network, the clock,
+//the LAN socket and the MQTT session
+static void network_connect()
+{
+    static bool joined = false;
+
+    // Once joined, only join again if the driver reports the link lost
+    if(!joined || network->get_connection_status() == NSAPI_STATUS_DISCONNECTED) {
+        joined = network_join();
+        networkAlive = true;
+        if(!joined) {
+            cloud_down("Wi-Fi connection failed");
+            return;
+        }
+    }
+    if(!rtcSynced) {
+        sync_clock();
+        networkAlive = true;
+    }
+    if(MBED_CONF_APP_LAN_MODE != LAN_MODE_OFF && !lanPublisher) {
+        open_lan();
+    }
+    if(!mqttClient) {
+        pc.printf("MQTT client: %d bytes packets, %lu bytes of RAM\r\n",
+                  MQTT_PACKET_SIZE, (unsigned long)sizeof(MQTTClient_t));
+        mqttNetwork = new MQTTNetwork(network, MQTT_CONNECT_TIMEOUT_MS);
+        mqttClient = new MQTTClient_t(*mqttNetwork, MQTT_COMMAND_TIMEOUT_MS);
+    }
+    if(cloud_connect() != MQTT::SUCCESS) {
+        cloud_down("MQTT connection failed");
+    }
+}
+
+//Bring the network up and keep the MQTT session alive, retrying in place.
+//Whatever it blocks on, the event thread keeps running the alarm.
+static void network_thread()
+{
+    network = NetworkInterface::get_default_instance();
+    if (!network) {
+        printf("Error! No network inteface found.\n");
+        networkRunning = false;
+        return;
+    }
+
+    bool first = true;
+    while(1) {
+        if(cloudUp) {
+            /* Check connection, then pass control to other thread. */
+            mqttMutex.lock();
+            bool up = mqttClient->isConnected();
+            if(up) {
+                up = (mqttClient->yield(NETWORK_YIELD_MS) == MQTT::SUCCESS);
+            }
+            mqttMutex.unlock();
+            if(!up) {
+                cloud_down("The client has disconnected");
+            }
+        } else if(first || (uint32_t)Kernel::get_ms_count() - cloudDownMs >= CLOUD_RETRY_MS) {
+            first = false;
+            network_connect();
+        } else {
+            wait_ms(NETWORK_YIELD_MS);
+        }
+        networkAlive = true;
+    }
+}
+
+
+//############################# CONFIGURATION ##################################
+
+/*
+ * Cold boot: give the user the reconfiguration window, then read the
+ * configuration file (or run the configuration web server if there is none).
+ */
+static int load_configuration()
+{
     // Try to mount the filesystem
     printf("Mounting the filesystem... ");
     fflush(stdout);
@@ -360,21 +943,22 @@ int main(int argc, char* argv[])
         }
     }
 
-    //Network variables
-    NetworkInterface* network = NULL;
-    MQTTNetwork* mqttNetwork = NULL;
-    MQTT::Client<MQTTNetwork, Countdown>* mqttClient = NULL;
-
-    // Enable button 1 (blue) on the board as erase-flash button
-    InterruptIn btn1 = InterruptIn(MBED_CONF_APP_USER_BUTTON);
-    // Setup the erase event on button press, use the event queue
-    // to avoid running in interrupt context
-    btn1.fall(mbed_event_queue()->event(btn1_rise_handler));
-
     //WAIT 3 seconds for user, if he wants to reconfigure the board he could press
     // blue button in that time window
     wait(3);
 
+    // Nobody is consuming yet: handle the button here and drop anything else
+    {
+        SensorEvent ev;
+        bool erase = false;
+        while(sensorEvents.pop(ev)) {
+            erase |= (ev.type == SENSOR_BUTTON);
+        }
+        if(erase) {
+            btn1_rise_handler();
+        }
+    }
+
     // Open the conf file
     printf("Opening \"/fs/conf.txt\"... ");
     fflush(stdout);
@@ -406,6 +990,7 @@ int main(int argc, char* argv[])
 
         while(1) {
             WebServerProcess();
+            WarmRestart::kick();
         }
     }
     //##################### END CONFIGURATION ##################################
@@ -426,17 +1011,24 @@ int main(int argc, char* argv[])
         char* id = strtok(NULL, " ");
         id[strlen(id)-2] = '\0';
 
-        char* ssidF = new char[strlen(ssid)];
-        char* pswF = new char[strlen(psw)];
-        char* idF = new char[strlen(id)];
-
-        strcpy(ssidF, ssid);
-        strcpy(pswF, psw);
-        strcpy(idF, id);
+        //Keep them in the retained state for warm restarts, a truncated
+        //value would be a wrong one
+        RetainedState& rs = warmRestart.get();
+        if (strlen(ssid) >= sizeof(rs.ssid) || strlen(psw) >= sizeof(rs.psw) ||
+            strlen(id) >= sizeof(rs.id)) {
+            printf("ERROR: configuration value too long\n");
+            delete[] str;
+            fclose(f);
+            fs.unmount();
+            return -1;
+        }
+        strcpy(rs.ssid, ssid);
+        strcpy(rs.psw, psw);
+        strcpy(rs.id, id);
 
-        printf("SSID: %s\n", ssidF);
-        printf("PSW: %s\n", pswF);
-        printf("ID: %s\n", idF);
+        printf("SSID: %s\n", rs.ssid);
+        printf("PSW: %s\n", rs.psw);
+        printf("ID: %s\n", rs.id);
 
         delete[] str;
 
@@ -458,177 +1050,111 @@ int main(int argc, char* argv[])
             error("error: %s (%d)\n", strerror(-err), err);
         }
 
-//############################ INIT WIFI #######################################
+    return 0;
+}
 
-        //Connect to custom Wi-fi access point
-        network = NetworkInterface::get_default_instance();
 
-        if (!network) {
-            printf("Error! No network inteface found.\n");
-            return 0;
-        }
+//################################# MAIN #######################################
 
-        WiFiInterface *wifi = network->wifiInterface();
-        if (wifi) {
-            printf("This is a Wi-Fi board\n");
-            // call WiFi-specific methods
-            nsapi_error_t ret = wifi->connect(ssidF, pswF, NSAPI_SECURITY_WPA_WPA2, 0);
-            if (ret) {
-                printf("Unable to connect! returned %d\n", ret);
-                return -1;
-            }
-            printf("Connected to network\n");
-        }
 
-        delete[] ssidF;
-        delete[] pswF;
+int main(int argc, char* argv[])
+{
+    // From here on a hang, or an error() halting the board, ends in a reset
+    WarmRestart::start_watchdog(WATCHDOG_TIMEOUT_MS);
 
+//##################### INIT SENSORS AND FILESYSTEM ############################
 
-    // sync the real time clock (RTC)
-    NTPClient ntp(network);
-    ntp.set_server("time.google.com", 123);
-    time_t now = ntp.get_timestamp();
-    set_time(now);
-    pc.printf("Time is now %s", ctime(&now));
+    RfChip.PCD_Init();
 
+    //INIT PINs and LED
+    led = 0;
 
-//##################### INIT  MQTT #############################################
+    //Set magnetic sensor in PullUp mode
+    doorSensor.mode(PullUp);
+    pc.printf("Pull up mode setted\n");
 
-    pc.printf("Connecting to host %s:%d ...\r\n", MQTT_SERVER_HOST_NAME, MQTT_SERVER_PORT);
-    {
-        mqttNetwork = new MQTTNetwork(network);
-        int rc = mqttNetwork->connect(MQTT_SERVER_HOST_NAME, MQTT_SERVER_PORT, SSL_CA_PEM,
-                SSL_CLIENT_CERT_PEM, SSL_CLIENT_PRIVATE_KEY_PEM);
-        if (rc != MQTT::SUCCESS){
-            const int MAX_TLS_ERROR_CODE = -0x1000;
-            // Network error
-            if((MAX_TLS_ERROR_CODE < rc) && (rc < 0)) {
-                pc.printf("ERROR from MQTTNetwork connect is %d.", rc);
-            }
-            // TLS error - mbedTLS error codes starts from -0x1000 to -0x8000.
-            if(rc <= MAX_TLS_ERROR_CODE) {
-                const int buf_size = 256;
-                char *buf = new char[buf_size];
-                mbedtls_strerror(rc, buf, buf_size);
-                pc.printf("TLS ERROR (%d) : %s\r\n", rc, buf);
-            }
-            return -1;
+    // Enable button 1 (blue) on the board as erase-flash button
+    InterruptIn btn1(MBED_CONF_APP_USER_BUTTON);
+    // The press is only queued in the ring, the erase runs in thread context
+    btn1.fall(btn1_fall_handler);
+
+    RetainedState& rs = warmRestart.get();
+    bool warm = warmRestart.can_warm_start();
+    if (warm) {
+        // Skip the reconfiguration window, the config file and the NTP sync
+        pc.printf("Warm restart, alarm %s, last message %lu\r\n",
+                  rs.alarmActive ? "on" : "off", (unsigned long)rs.lastSeq);
+        publishSeq = rs.lastSeq;
+        alarmActive = rs.alarmActive;
+        alarmArmed = rs.alarmArmed;
+        led = alarmActive ? 1 : 0;
+    } else {
+        memset(&rs, 0, sizeof(rs));
+        if (load_configuration() != 0) {
+            // Nothing to cache: the next boot must be a cold one
+            warmRestart.invalidate();
+            warmRestart.reboot("configuration failed");
         }
+        // The sequence numbers restart from 0: a new stream for the hub
+        rs.bootId = WarmRestart::new_boot_id();
+        warmRestart.seal();
+    }
+    rtcSynced = rs.rtcValid;
+    WarmRestart::kick();
+
+    //Door edges are queued from now on, the ring keeps them until the event
+    //thread starts. A door already open raises the alarm.
+    doorSensor.rise(door_rise_handler);
+    doorSensor.fall(door_fall_handler);
+    if(doorSensor.read() == 1) {
+        SensorEvent ev = { (uint32_t)Kernel::get_ms_count(), SENSOR_DOOR, 1 };
+        sensorEvents.push_from_thread(ev);
     }
-    pc.printf("Connection established.\r\n");
-    pc.printf("\r\n");
 
+//############################### LOGIC ########################################
 
-    pc.printf("MQTT client is trying to connect the server ...\r\n");
-    {
-        MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
-        data.MQTTVersion = 3;
-        data.clientID.cstring = (char *)MQTT_CLIENT_ID;
-        data.username.cstring = (char *)MQTT_USERNAME;
-        data.password.cstring = (char *)MQTT_PASSWORD;
-
-        mqttClient = new MQTT::Client<MQTTNetwork, Countdown>(*mqttNetwork);
-        int rc = mqttClient->connect(data);
-        if (rc != MQTT::SUCCESS) {
-            pc.printf("ERROR: rc from MQTT connect is %d\r\n", rc);
-            return -1;
-        }
+    //Prepare the constant part of the payload with TWITTER ID
+    if(!eventPayload.init(rs.id, MQTT_CLIENT_ID, rs.bootId)) {
+        pc.printf("ERROR: Twitter ID too long\r\n");
+        // Back to the reconfiguration window
+        warmRestart.invalidate();
+        warmRestart.reboot("payload setup failed");
     }
-    pc.printf("Client connected.\r\n");
-    pc.printf("\r\n");
 
-//############################### LOGIC ########################################
+    //Armed from here on: alerts raised before the network is up wait for it
+    eventThread.start(event_thread);
+
+//##################### INIT NETWORK ##########################################
 
-    //Prepare payload with TWITTER ID
-    char* payload = new char[128];
-    memset(payload, 0, 128);
-    strcpy(payload, "{ \"payload\": ");
-    strcat(strcat(payload, idF), " }");
-    delete[] idF;
+    //Wi-Fi, NTP, LAN and MQTT come up in the background, and are retried
+    //there when they are lost
+    networkRunning = true;
+    networkThread.start(network_thread);
 
+    //The RFID reader has no interrupt line: poll it while the alert is on.
+    //This loop is also the watchdog supervisor: it only kicks while the
+    //event thread keeps looping and the network thread is not stuck.
+    uint32_t networkSeenMs = (uint32_t)Kernel::get_ms_count();
     while(1) {
-        /* Check connection */
-        if(!mqttClient->isConnected()){
-            break;
+        if(alarmActive && RfChip.PICC_IsNewCardPresent()) {
+            SensorEvent ev = { (uint32_t)Kernel::get_ms_count(), SENSOR_RFID, 1 };
+            sensorEvents.push_from_thread(ev);
+            eventWakeup.release();
         }
-        /* Pass control to other thread. */
-        if(mqttClient->yield() != MQTT::SUCCESS) {
-            break;
+        uint32_t nowMs = (uint32_t)Kernel::get_ms_count();
+        if(networkAlive || !networkRunning) {
+            networkAlive = false;
+            networkSeenMs = nowMs;
         }
-        /* Publish data */
-
-        // IF DOOR IS OPEN
-        if (doorSensor.read() == 1) {
-            static unsigned short id = 0;
-
-            //START LED ALERT (A SOUND ALERT COULD BE IMPLEMENTED AS WELL)
-            led = 1;
-
-            MQTT::Message message;
-            message.retained = false;
-            message.dup = false;
-
-            const size_t buf_size = 50;
-            char *buf = new char[buf_size];
-            message.payload = (void*)buf;
-
-            message.qos = MQTT::QOS0;
-            message.id = id++;
-            int ret = snprintf(buf, buf_size, "%s", payload);
-            if(ret < 0) {
-                pc.printf("ERROR: snprintf() returns %d.", ret);
-                continue;
-            }
-            message.payloadlen = ret;
-            // Publish a message.
-            pc.printf("Publishing message.\r\n");
-            int rc = mqttClient->publish(MQTT_TOPIC_PUB, message);
-            if(rc != MQTT::SUCCESS) {
-                pc.printf("ERROR: rc from MQTT publish is %d\r\n", rc);
-            }
-            pc.printf("Message published.\r\n");
-            delete[] buf;
-            delete[] payload;
-
-
-            //check nfc for shutting off the alarm
-            pc.printf("Wait alert to stop\n");
-            while(! RfChip.PICC_IsNewCardPresent()) {
-                wait(0.5);
-            }
-            pc.printf("Alert stopped\n");
-
-            //reset led to off state and stopAlarm to false
-            led = 0;
-
-            //Wait until door is closed before restarting alarm, once it's shutted off
-            //the main cycle can restart checking door sensor again.
-            pc.printf("Wait door to be closed again\n");
-            while(doorSensor.read() == 1) {
-                wait(0.5);
-            }
+        if(nowMs - networkSeenMs >= NETWORK_STALL_MS) {
+            report_costs();
+            //Come back armed, the retained state is sealed by the event thread
+            warmRestart.reboot("network thread stuck");
         }
-        wait(0.5);
-    }
-
-    pc.printf("The client has disconnected.\r\n");
-
-//######################### CLEANUP OPERATIONS #################################
-    if(mqttClient) {
-        if(isSubscribed) {
-            mqttClient->unsubscribe(MQTT_TOPIC_SUB);
-            mqttClient->setMessageHandler(MQTT_TOPIC_SUB, 0);
+        if(eventAlive) {
+            eventAlive = false;
+            WarmRestart::kick();
         }
-        if(mqttClient->isConnected())
-            mqttClient->disconnect();
-        delete mqttClient;
-    }
-    if(mqttNetwork) {
-        mqttNetwork->disconnect();
-        delete mqttNetwork;
-    }
-    if(network) {
-        network->disconnect();
-        // network is not created by new.
+        wait(0.5);
     }
 }
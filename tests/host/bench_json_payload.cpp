@@ -0,0 +1,48 @@
+/*
+ * Micro-benchmark of the event payload encoding: time per encode() into a
+ * stack JsonBuffer, after checking the output against the documented format.
+ */
+#include "JsonPayload.h"
+#include "check.h"
+#include <chrono>
+
+#define ITERATIONS 1000000UL
+
+int main(int argc, char* argv[])
+{
+    uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : ITERATIONS;
+
+    EventPayload payload;
+    if (!check(payload.init("1234567890", "detector-01", 3735928559UL), "init")) {
+        return check_result();
+    }
+
+    SensorEvent ev;
+    ev.ms = 0;
+    ev.type = SENSOR_DOOR;
+    ev.state = 1;
+
+    const char expected[] = "{ \"payload\": 1234567890, \"device\": \"detector-01\", \"boot\": 3735928559, "
+                            "\"ts\": 1571234567, \"seq\": 42, \"uptime\": 3600, \"sensor\": \"door\", \"state\": 1 }";
+    JsonBuffer<EVENT_PAYLOAD_SIZE> out;
+    if (!check(payload.encode(out, ev, 42, 1571234567, 3600) && strcmp(out.c_str(), expected) == 0,
+               "encoded payload")) {
+        printf("  got %s\n", out.c_str());
+        return check_result();
+    }
+
+    // The sum of the sizes keeps the loop from being optimized away
+    size_t bytes = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        JsonBuffer<EVENT_PAYLOAD_SIZE> buf;
+        ev.state = i & 1;
+        payload.encode(buf, ev, i, 1571234567 + i, i / 1000);
+        bytes += buf.size();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%lu events, %.1f ns per event, %.1f bytes per event\n",
+           (unsigned long)iterations, ns / iterations, (double)bytes / iterations);
+    return check_result();
+}
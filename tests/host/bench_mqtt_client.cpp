@@ -0,0 +1,276 @@
+/*
+ * Cost of the MQTT client for several packet sizes and handler counts,
+ * checked against a recorded baseline:
+ *
+ *   - RAM: sizeof the client, must never grow
+ *   - publish(): one QoS0 message filling the packet
+ *   - cycle(), idle: nothing to read, what every yield() pays per loop
+ *   - cycle(), inbound: one PUBLISH read and dispatched to the last handler
+ *
+ * yield() loops on cycle() until its timeout expires, so its own duration
+ * says nothing: the mock broker (shim/TLSSocket.h) counts the cycles run
+ * during a timed yield() and the cost of one cycle is the time divided by
+ * that count.
+ * Every figure is the best of a few runs, to keep the noise out.
+ * The CONNECT the firmware sends is also checked against the size the
+ * client is built for (MQTT_CONNECT_PACKET_SIZE).
+ *
+ *   bench_mqtt_client <baseline file> [--update] [--tolerance <percent>]
+ */
+#include "MQTTClientConfig.h"
+#include "check.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define RUNS            5
+#define PUBLISHES       20000
+#define YIELD_WINDOW_MS 50
+
+static const char* const TOPICS[] = {
+    "bench/0", "bench/1", "bench/2", "bench/3", "bench/4", "bench/5", "bench/6", "bench/7"
+};
+
+struct Result {
+    std::string name;
+    unsigned long ram;
+    unsigned long publishNs;
+    unsigned long idleNs;
+    unsigned long inboundNs;
+};
+
+static uint32_t delivered = 0;
+
+static void on_message(MQTT::MessageData&)
+{
+    delivered++;
+}
+
+// Bytes taken by the fixed header of a serialized packet
+static int fixed_header_size(const unsigned char* packet)
+{
+    int n = 1;
+    while (packet[n++] & 0x80) {
+    }
+    return n;
+}
+
+static void check_connect_size()
+{
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.MQTTVersion = MQTT_VERSION;
+    data.clientID.cstring = (char *)MQTT_CLIENT_ID;
+    data.username.cstring = (char *)MQTT_USERNAME;
+    data.password.cstring = (char *)MQTT_PASSWORD;
+    static unsigned char packet[2 * MQTT_PACKET_SIZE];
+    int len = MQTTSerialize_connect(packet, sizeof(packet), &data);
+    if (!check(len > 0 && len - fixed_header_size(packet) == MQTT_CONNECT_PACKET_SIZE - MQTT_FIXED_HEADER_SIZE,
+               "firmware CONNECT matches MQTT_CONNECT_PACKET_SIZE")) {
+        printf("  %d bytes, MQTT_CONNECT_PACKET_SIZE %d\n", len, (int)MQTT_CONNECT_PACKET_SIZE);
+    }
+}
+
+static uint64_t now_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename Client, int PACKET, int HANDLERS>
+static Result bench(const char* name)
+{
+    Result r;
+    r.name = name;
+    r.ram = sizeof(Client);
+    r.publishNs = r.idleNs = r.inboundNs = (unsigned long)-1;
+
+    MockBroker& broker = MockBroker::get();
+    NetworkInterface iface;
+    MQTTNetwork network(&iface);
+    check(network.connect("broker", 8883) == 0, name, "network connect");
+    Client* client = new Client(network, 1000);
+
+    MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+    data.MQTTVersion = MQTT_VERSION;
+    data.clientID.cstring = (char *)"bench";
+    check(client->connect(data) == MQTT::SUCCESS, name, "connect");
+    for (int i = 0; i < HANDLERS; i++) {
+        check(client->setMessageHandler(TOPICS[i], on_message) == MQTT::SUCCESS, name, "handler");
+    }
+
+    // The largest message the packet holds, on the topic of the last handler
+    static unsigned char payload[PACKET];
+    const char* topic = TOPICS[HANDLERS - 1];
+    int payloadLen = PACKET - MQTT_FIXED_HEADER_SIZE - 2 - (int)strlen(topic);
+    memset(payload, 'x', payloadLen);
+
+    MQTT::Message message;
+    message.retained = false;
+    message.dup = false;
+    message.qos = MQTT::QOS0;
+    message.id = 0;
+    message.payload = payload;
+    message.payloadlen = payloadLen;
+
+    unsigned char inbound[PACKET];
+    MQTTString topicName = MQTTString_initializer;
+    topicName.cstring = (char *)topic;
+    int inboundLen = MQTTSerialize_publish(inbound, PACKET, 0, 0, 0, 0, topicName, payload, payloadLen);
+    check(inboundLen > 0, name, "inbound packet");
+
+    for (int run = 0; run < RUNS; run++) {
+        broker.reset_counters();
+        uint64_t t = now_ns();
+        for (int i = 0; i < PUBLISHES; i++) {
+            if (client->publish(topic, message) != MQTT::SUCCESS) {
+                check(false, name, "publish");
+                break;
+            }
+        }
+        t = now_ns() - t;
+        check(broker.write_count() == PUBLISHES, name, "one write per publish");
+        r.publishNs = std::min(r.publishNs, (unsigned long)(t / PUBLISHES));
+
+        broker.set_inbound(inbound, 0);
+        broker.reset_counters();
+        t = now_ns();
+        client->yield(YIELD_WINDOW_MS);
+        t = now_ns() - t;
+        check(broker.cycle_count() > 0, name, "no idle cycle");
+        r.idleNs = std::min(r.idleNs, (unsigned long)(t / std::max(broker.cycle_count(), (uint32_t)1)));
+
+        broker.set_inbound(inbound, inboundLen);
+        broker.reset_counters();
+        delivered = 0;
+        t = now_ns();
+        client->yield(YIELD_WINDOW_MS);
+        t = now_ns() - t;
+        broker.set_inbound(inbound, 0);
+        check(broker.cycle_count() > 0 && delivered == broker.cycle_count(), name,
+              "one message delivered per cycle");
+        r.inboundNs = std::min(r.inboundNs, (unsigned long)(t / std::max(broker.cycle_count(), (uint32_t)1)));
+    }
+
+    delete client;
+    return r;
+}
+
+static bool read_baseline(const char* path, std::vector<Result>& baseline)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    char line[160];
+    while (fgets(line, sizeof(line), f)) {
+        char name[64];
+        Result r;
+        if (line[0] == '#' ||
+            sscanf(line, "%63s %lu %lu %lu %lu", name, &r.ram, &r.publishNs, &r.idleNs, &r.inboundNs) != 5) {
+            continue;
+        }
+        r.name = name;
+        baseline.push_back(r);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool write_baseline(const char* path, const std::vector<Result>& results)
+{
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "# Recorded by bench_mqtt_client --update, on the machine that runs the checks.\n");
+    fprintf(f, "# name ram_bytes publish_ns cycle_idle_ns cycle_inbound_ns\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(f, "%s %lu %lu %lu %lu\n", r.name.c_str(), r.ram, r.publishNs, r.idleNs, r.inboundNs);
+    }
+    fclose(f);
+    return true;
+}
+
+static void check_time(const Result& r, unsigned long got, unsigned long base,
+                       unsigned long tolerance, const char* what)
+{
+    if (!check(got * 100 <= base * (100 + tolerance), r.name.c_str(), what)) {
+        printf("  %lu ns, baseline %lu ns (+%lu%%)\n", got, base, tolerance);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("usage: %s <baseline file> [--update] [--tolerance <percent>]\n", argv[0]);
+        return 2;
+    }
+    const char* baselinePath = argv[1];
+    bool update = false;
+    unsigned long tolerance = 50;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--update") == 0) {
+            update = true;
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = strtoul(argv[++i], NULL, 10);
+        }
+    }
+
+    check_connect_size();
+
+    std::vector<Result> results;
+    // What the firmware really builds
+    results.push_back(bench<MQTTClient_t, MQTT_PACKET_SIZE, MQTT_MESSAGE_HANDLERS>("firmware"));
+    results.push_back(bench<MQTT::Client<MQTTNetwork, Countdown, 128, 1>, 128, 1>("pkt128_h1"));
+    results.push_back(bench<MQTT::Client<MQTTNetwork, Countdown, 512, 1>, 512, 1>("pkt512_h1"));
+    results.push_back(bench<MQTT::Client<MQTTNetwork, Countdown, 512, 5>, 512, 5>("pkt512_h5"));
+    results.push_back(bench<MQTT::Client<MQTTNetwork, Countdown, 1024, 1>, 1024, 1>("pkt1024_h1"));
+    results.push_back(bench<MQTT::Client<MQTTNetwork, Countdown, 1024, 5>, 1024, 5>("pkt1024_h5"));
+
+    printf("%-12s %8s %12s %12s %12s\n", "client", "ram", "publish ns", "idle ns", "inbound ns");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        printf("%-12s %8lu %12lu %12lu %12lu\n", r.name.c_str(), r.ram, r.publishNs, r.idleNs, r.inboundNs);
+    }
+
+    if (update) {
+        if (!write_baseline(baselinePath, results)) {
+            printf("FAIL: cannot write %s\n", baselinePath);
+            return 1;
+        }
+        printf("Baseline written to %s\n", baselinePath);
+        return check_result();
+    }
+
+    std::vector<Result> baseline;
+    if (!read_baseline(baselinePath, baseline)) {
+        printf("FAIL: cannot read %s\n", baselinePath);
+        return 1;
+    }
+    if (baseline.empty()) {
+        printf("FAIL: nothing recorded in %s, run the mqtt_bench_baseline target\n", baselinePath);
+        return 1;
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        const Result* base = NULL;
+        for (size_t j = 0; j < baseline.size(); j++) {
+            if (baseline[j].name == r.name) {
+                base = &baseline[j];
+            }
+        }
+        if (!check(base != NULL, r.name.c_str(), "not in the baseline, record it with --update")) {
+            continue;
+        }
+        if (!check(r.ram <= base->ram, r.name.c_str(), "RAM grew")) {
+            printf("  %lu bytes, baseline %lu\n", r.ram, base->ram);
+        }
+        check_time(r, r.publishNs, base->publishNs, tolerance, "publish");
+        check_time(r, r.idleNs, base->idleNs, tolerance, "idle cycle");
+        check_time(r, r.inboundNs, base->inboundNs, tolerance, "inbound cycle");
+    }
+
+    return check_result();
+}
@@ -0,0 +1,49 @@
+/*
+ * Checks shared by the host tests: a failed check is printed and counted,
+ * the test goes on and check_result() gives its exit code.
+ */
+#ifndef _HOST_CHECK_H_
+#define _HOST_CHECK_H_
+
+#include <stdio.h>
+#include <atomic>
+
+// Only the first failures are printed, a broken loop would flood the log
+#define CHECK_PRINT_MAX 20
+
+// Checks may run on several threads
+inline std::atomic<int>& check_failures()
+{
+    static std::atomic<int> failures(0);
+    return failures;
+}
+
+inline bool check(bool ok, const char* what)
+{
+    if (!ok && check_failures()++ < CHECK_PRINT_MAX) {
+        printf("FAIL: %s\n", what);
+    }
+    return ok;
+}
+
+// Same, for tests that run one case after the other
+inline bool check(bool ok, const char* name, const char* what)
+{
+    if (!ok && check_failures()++ < CHECK_PRINT_MAX) {
+        printf("FAIL: %s: %s\n", name, what);
+    }
+    return ok;
+}
+
+inline int check_result()
+{
+    int failures = check_failures();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
+
+#endif // _HOST_CHECK_H_
@@ -0,0 +1,42 @@
+/*
+ * Host stand-in for the Countdown timer of the MQTT library, on the
+ * monotonic clock.
+ */
+#ifndef _HOST_MQTTMBED_H_
+#define _HOST_MQTTMBED_H_
+
+#include "mbed.h"
+#include <chrono>
+
+class Countdown {
+public:
+    Countdown() : end(std::chrono::steady_clock::now()) {
+    }
+
+    Countdown(int ms) {
+        countdown_ms(ms);
+    }
+
+    bool expired() {
+        return std::chrono::steady_clock::now() >= end;
+    }
+
+    void countdown_ms(unsigned long ms) {
+        end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    }
+
+    void countdown(int seconds) {
+        countdown_ms((unsigned long)seconds * 1000);
+    }
+
+    int left_ms() {
+        std::chrono::steady_clock::duration left = end - std::chrono::steady_clock::now();
+        long ms = (long)std::chrono::duration_cast<std::chrono::milliseconds>(left).count();
+        return ms > 0 ? (int)ms : 0;
+    }
+
+private:
+    std::chrono::steady_clock::time_point end;
+};
+
+#endif // _HOST_MQTTMBED_H_
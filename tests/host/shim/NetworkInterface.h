@@ -0,0 +1,21 @@
+/*
+ * Host stand-in for the network types of mbed OS.
+ */
+#ifndef _HOST_NETWORKINTERFACE_H_
+#define _HOST_NETWORKINTERFACE_H_
+
+#include "mbed.h"
+
+typedef int nsapi_error_t;
+typedef int nsapi_size_or_error_t;
+typedef unsigned int nsapi_size_t;
+
+#define NSAPI_ERROR_OK           0
+#define NSAPI_ERROR_WOULD_BLOCK  -3001
+#define NSAPI_ERROR_NO_SOCKET    -3005
+#define NSAPI_ERROR_DEVICE_ERROR -3012
+
+class NetworkInterface {
+};
+
+#endif // _HOST_NETWORKINTERFACE_H_
@@ -0,0 +1,124 @@
+/*
+ * Host stand-in for TLSSocket, so that the firmware MQTTNetwork runs on a PC
+ * against a mock broker: no socket, CONNECT is answered with CONNACK and the
+ * same inbound packet can be fed over and over.
+ *
+ * Every read that starts a new packet is one cycle of the MQTT client,
+ * whether a packet comes or not, so the number of cycles run by a timed
+ * yield() is known. The socket timeouts in force at connect and send time
+ * are recorded.
+ */
+#ifndef _HOST_TLSSOCKET_H_
+#define _HOST_TLSSOCKET_H_
+
+#include "NetworkInterface.h"
+
+#define MOCK_PACKET_SIZE 2048
+
+class MockBroker {
+public:
+    // One broker for every socket: MQTTNetwork recreates its socket on connect
+    static MockBroker& get() {
+        static MockBroker broker;
+        return broker;
+    }
+
+    nsapi_size_or_error_t recv(void* data, nsapi_size_t size) {
+        if (rxPos == rxLen) {
+            cycles++;
+            if (inboundLen == 0) {
+                return NSAPI_ERROR_WOULD_BLOCK;
+            }
+            memcpy(rx, inbound, inboundLen);
+            rxLen = inboundLen;
+            rxPos = 0;
+        }
+        int n = (int)size < rxLen - rxPos ? (int)size : rxLen - rxPos;
+        memcpy(data, rx + rxPos, n);
+        rxPos += n;
+        return n;
+    }
+
+    nsapi_size_or_error_t send(const void* data, nsapi_size_t size) {
+        // CONNECT: accept the session
+        if (size > 0 && (((const unsigned char*)data)[0] & 0xF0) == 0x10) {
+            static const unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+            memcpy(rx, connack, sizeof(connack));
+            rxLen = sizeof(connack);
+            rxPos = 0;
+        }
+        writes++;
+        written += size;
+        return (nsapi_size_or_error_t)size;
+    }
+
+    // Served again every time the previous copy has been read, 0 to stop
+    void set_inbound(const unsigned char* packet, int len) {
+        memcpy(inbound, packet, len);
+        inboundLen = len;
+    }
+
+    void reset_counters() {
+        cycles = 0;
+        writes = 0;
+        written = 0;
+    }
+
+    uint32_t cycle_count() const { return cycles; }
+    uint32_t write_count() const { return writes; }
+    uint32_t bytes_written() const { return written; }
+
+    void on_connect(int timeoutMs) { connectTimeout = timeoutMs; }
+    void on_send(int timeoutMs) { sendTimeout = timeoutMs; }
+    int connect_timeout() const { return connectTimeout; }
+    int send_timeout() const { return sendTimeout; }
+
+private:
+    MockBroker() : rxLen(0), rxPos(0), inboundLen(0), cycles(0), writes(0), written(0),
+        connectTimeout(-1), sendTimeout(-1) {
+    }
+
+    unsigned char rx[MOCK_PACKET_SIZE];
+    int rxLen;
+    int rxPos;
+    unsigned char inbound[MOCK_PACKET_SIZE];
+    int inboundLen;
+
+    uint32_t cycles;
+    uint32_t writes;
+    uint32_t written;
+    int connectTimeout;
+    int sendTimeout;
+};
+
+class TLSSocket {
+public:
+    // Blocking without timeout, as a fresh mbed socket
+    TLSSocket() : timeout(-1) {
+    }
+
+    nsapi_error_t open(NetworkInterface*) { return NSAPI_ERROR_OK; }
+    nsapi_error_t close() { return NSAPI_ERROR_OK; }
+    nsapi_error_t set_root_ca_cert(const char*) { return NSAPI_ERROR_OK; }
+    nsapi_error_t set_client_cert_key(const char*, const char*) { return NSAPI_ERROR_OK; }
+    void set_timeout(int timeoutMs) { timeout = timeoutMs; }
+
+    nsapi_error_t connect(const char*, uint16_t) {
+        MockBroker::get().on_connect(timeout);
+        return NSAPI_ERROR_OK;
+    }
+
+    nsapi_size_or_error_t send(const void* data, nsapi_size_t size) {
+        MockBroker::get().on_send(timeout);
+        return MockBroker::get().send(data, size);
+    }
+
+    nsapi_size_or_error_t recv(void* data, nsapi_size_t size) {
+        return MockBroker::get().recv(data, size);
+    }
+
+private:
+    int timeout;
+};
+
+#endif // _HOST_TLSSOCKET_H_
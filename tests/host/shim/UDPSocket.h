@@ -0,0 +1,99 @@
+/*
+ * Host stand-in for the mbed UDP socket API, on top of POSIX sockets.
+ * IPv4 only, enough for LanPublisher and a loopback hub.
+ */
+#ifndef _HOST_UDPSOCKET_H_
+#define _HOST_UDPSOCKET_H_
+
+#include "NetworkInterface.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+class SocketAddress {
+public:
+    SocketAddress() {
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+    }
+
+    SocketAddress(const char* ip, uint16_t port) : SocketAddress() {
+        inet_pton(AF_INET, ip, &addr.sin_addr);
+        addr.sin_port = htons(port);
+    }
+
+    uint16_t get_port() const { return ntohs(addr.sin_port); }
+
+    sockaddr_in addr;
+};
+
+class UDPSocket {
+public:
+    UDPSocket() : fd(-1) {
+    }
+
+    ~UDPSocket() {
+        close();
+    }
+
+    nsapi_error_t open(NetworkInterface*) {
+        fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+        return fd < 0 ? NSAPI_ERROR_NO_SOCKET : NSAPI_ERROR_OK;
+    }
+
+    nsapi_error_t close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        return NSAPI_ERROR_OK;
+    }
+
+    nsapi_error_t bind(const SocketAddress& address) {
+        return ::bind(fd, (const sockaddr*)&address.addr, sizeof(address.addr)) < 0 ?
+               NSAPI_ERROR_DEVICE_ERROR : NSAPI_ERROR_OK;
+    }
+
+    void set_blocking(bool blocking) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+    }
+
+    void set_timeout(int timeoutMs) {
+        set_blocking(true);
+        timeval tv = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    // The port the system picked, once bound
+    uint16_t local_port() const {
+        sockaddr_in a;
+        socklen_t len = sizeof(a);
+        getsockname(fd, (sockaddr*)&a, &len);
+        return ntohs(a.sin_port);
+    }
+
+    nsapi_size_or_error_t sendto(const SocketAddress& address, const void* data, size_t size) {
+        ssize_t n = ::sendto(fd, data, size, 0, (const sockaddr*)&address.addr, sizeof(address.addr));
+        return n < 0 ? NSAPI_ERROR_DEVICE_ERROR : (nsapi_size_or_error_t)n;
+    }
+
+    nsapi_size_or_error_t recvfrom(SocketAddress* address, void* data, size_t size) {
+        socklen_t len = sizeof(address->addr);
+        ssize_t n = ::recvfrom(fd, data, size, 0, (sockaddr*)&address->addr, &len);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? NSAPI_ERROR_WOULD_BLOCK :
+                   NSAPI_ERROR_DEVICE_ERROR;
+        }
+        return (nsapi_size_or_error_t)n;
+    }
+
+private:
+    int fd;
+};
+
+#endif // _HOST_UDPSOCKET_H_
@@ -0,0 +1,23 @@
+/*
+ * Host stand-in for the few mbed OS symbols the header-only modules use, so
+ * that they can be tested and benchmarked on a PC.
+ */
+#ifndef _HOST_MBED_H_
+#define _HOST_MBED_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+
+#define __DMB() std::atomic_thread_fence(std::memory_order_seq_cst)
+#define MBED_STATIC_ASSERT(expr, msg) static_assert(expr, msg)
+#define MBED_SECTION(name) __attribute__((section(name)))
+
+inline void core_util_critical_section_enter() {}
+inline void core_util_critical_section_exit() {}
+
+#endif // _HOST_MBED_H_
@@ -0,0 +1,116 @@
+/*
+ * DoorAnalytics on scripted door activity: percentiles of the open
+ * durations, flap counting, the one-shot left-open alert, the period reset
+ * after a summary and the saturation of opens_last_hour().
+ */
+#include "DoorAnalytics.h"
+#include "check.h"
+
+static void test_percentiles()
+{
+    DurationSketch equal;
+    for (int i = 0; i < 10; i++) {
+        equal.add(45);
+    }
+    check(equal.percentile(50) == 45, "p50 of equal samples");
+    check(equal.percentile(90) == 45, "p90 of equal samples");
+    check(equal.max() == 45, "max of equal samples");
+
+    // 1..100 s: the percentile is the sample of that rank
+    DurationSketch spread;
+    for (uint32_t s = 1; s <= 100; s++) {
+        spread.add(s);
+    }
+    check(spread.percentile(0) == 1, "p0 is the smallest sample");
+    check(spread.percentile(50) == 50, "p50 of 1..100");
+    check(spread.percentile(90) == 90, "p90 of 1..100");
+    check(spread.percentile(100) == 100, "p100 is the largest sample");
+
+    // Never outside the samples of the bucket, even in the open ended one
+    DurationSketch wide;
+    wide.add(4000);
+    wide.add(9000);
+    check(wide.percentile(50) == 4000 && wide.percentile(100) == 9000, "open ended bucket");
+
+    DurationSketch empty;
+    check(empty.percentile(50) == 0 && empty.count() == 0, "empty sketch");
+}
+
+static void test_flaps()
+{
+    DoorAnalytics a(0);
+    JsonBuffer<EVENT_PAYLOAD_SIZE> out;
+    a.on_open(0);
+    a.on_close(5000);
+    a.on_open(8000);     // 3 s after the close: flap
+    a.on_close(20000);
+    a.on_open(30000);    // 10 s after the close: not a flap
+    a.on_close(31000);
+    a.write_summary(out, 40000);
+    check(strstr(out.c_str(), "\"opens\": 3,") != NULL, "three openings");
+    check(strstr(out.c_str(), "\"flaps\": 1,") != NULL, "one flap");
+    check(strstr(out.c_str(), "\"open_max\": 12,") != NULL, "longest opening");
+    check(strstr(out.c_str(), "\"open_now\": 0 }") != NULL, "door closed now");
+}
+
+static void test_left_open()
+{
+    DoorAnalytics a(60);
+    a.on_open(1000);
+    check(!a.check_left_open(60999), "not left open before the threshold");
+    check(a.check_left_open(61000), "left open at the threshold");
+    check(!a.check_left_open(70000), "reported once per opening");
+    check(a.open_for(70000) == 69, "open for");
+    a.on_close(80000);
+    check(!a.check_left_open(200000), "closed door is not left open");
+    a.on_open(300000);
+    check(a.check_left_open(360000), "reported again on the next opening");
+
+    DoorAnalytics off(0);
+    off.on_open(0);
+    check(!off.check_left_open(10000000), "disabled with 0");
+}
+
+static void test_reset_after_summary()
+{
+    DoorAnalytics a(60);
+    a.on_open(0);
+    a.on_close(30000);
+    a.on_open(35000);
+    a.check_left_open(100000);
+    a.on_close(120000);
+
+    JsonBuffer<EVENT_PAYLOAD_SIZE> first;
+    a.write_summary(first, 130000);
+    check(strstr(first.c_str(), "\"opens\": 2, \"opens_hour\": 2, \"flaps\": 1, \"left_open\": 1,") != NULL,
+          "first period");
+
+    a.reset_period();
+    JsonBuffer<EVENT_PAYLOAD_SIZE> second;
+    a.write_summary(second, 140000);
+    check(strstr(second.c_str(), "\"opens\": 0, \"opens_hour\": 2, \"flaps\": 0, \"left_open\": 0, "
+                                 "\"open_p50\": 0, \"open_p90\": 0, \"open_max\": 0,") != NULL,
+          "period counters reset, hourly count kept");
+}
+
+static void test_opens_hour()
+{
+    DoorAnalytics a(0);
+    for (uint32_t i = 0; i < DOOR_HISTORY_SIZE + 10; i++) {
+        a.on_open(i * 20000);
+        a.on_close(i * 20000 + 1000);
+    }
+    uint32_t now = (DOOR_HISTORY_SIZE + 10) * 20000;
+    check(a.opens_last_hour(now) == DOOR_HISTORY_SIZE, "saturates at DOOR_HISTORY_SIZE");
+    check(a.opens_last_hour(now + HOUR_MS) == 0, "nothing after an hour");
+}
+
+int main()
+{
+    test_percentiles();
+    test_flaps();
+    test_left_open();
+    test_reset_after_summary();
+    test_opens_hour();
+    return check_result();
+}
@@ -0,0 +1,110 @@
+/*
+ * EdgeDebouncer on recorded edge sequences: bounce bursts give one edge, a
+ * door opened and closed while nobody consumed the ring gives both edges,
+ * and a level reached through bounce is accepted once it held.
+ */
+#include "SensorEventRing.h"
+#include "check.h"
+
+#define HOLD_MS 50
+
+// Feed the edges, collect the accepted levels as a string ("10" = open, closed)
+static void run(EdgeDebouncer& d, const uint32_t* ms, const uint8_t* levels, int n, char* out)
+{
+    int len = 0;
+    for (int i = 0; i < n; i++) {
+        SensorEvent ev = { ms[i], SENSOR_DOOR, levels[i] };
+        SensorEvent accepted[2];
+        int k = d.feed(ev, accepted);
+        for (int j = 0; j < k; j++) {
+            out[len++] = '0' + accepted[j].state;
+        }
+    }
+    out[len] = '\0';
+}
+
+static void test_clean_edges()
+{
+    EdgeDebouncer d(HOLD_MS, 0);
+    const uint32_t ms[] = { 1000, 5000, 9000, 9500 };
+    const uint8_t levels[] = { 1, 0, 1, 0 };
+    char out[16];
+    run(d, ms, levels, 4, out);
+    check(strcmp(out, "1010") == 0, "clean edges all accepted");
+    check(d.current() == 0, "door closed at the end");
+}
+
+static void test_bounce()
+{
+    EdgeDebouncer d(HOLD_MS, 0);
+    // Opening with bounce, then closing with bounce
+    const uint32_t ms[] = { 1000, 1002, 1003, 1010, 3000, 3001, 3004 };
+    const uint8_t levels[] = { 1, 0, 1, 1, 0, 1, 0 };
+    char out[16];
+    run(d, ms, levels, 7, out);
+    check(strcmp(out, "10") == 0, "one edge per bounce burst");
+    SensorEvent ev;
+    check(!d.settle(10000, ev), "nothing left once the contact settled");
+}
+
+static void test_late_consumer()
+{
+    // Open and close queued while the consumer was busy, consumed much later:
+    // the pin is closed again by then, both edges must still come out
+    EdgeDebouncer d(HOLD_MS, 0);
+    const uint32_t ms[] = { 1000, 1800 };
+    const uint8_t levels[] = { 1, 0 };
+    char out[16];
+    run(d, ms, levels, 2, out);
+    check(strcmp(out, "10") == 0, "quick open and close both accepted");
+}
+
+static void test_settle()
+{
+    // A very short opening: the close is bounce time away from the open
+    EdgeDebouncer d(HOLD_MS, 0);
+    SensorEvent ev = { 1000, SENSOR_DOOR, 1 };
+    SensorEvent out[2];
+    check(d.feed(ev, out) == 1 && out[0].state == 1, "open accepted");
+    ev.ms = 1020;
+    ev.state = 0;
+    check(d.feed(ev, out) == 0, "close inside the hold time is held");
+    check(d.current() == 1, "still open while held");
+    check(!d.settle(1040, ev), "not settled before the hold time");
+    check(d.settle(1060, ev) && ev.state == 0 && ev.ms == 1020, "close accepted once it held");
+    check(d.current() == 0, "closed after settle");
+
+    // The held level is also accepted by the next edge, before that edge
+    EdgeDebouncer e(HOLD_MS, 0);
+    SensorEvent a = { 1000, SENSOR_DOOR, 1 };
+    e.feed(a, out);
+    a.ms = 1020;
+    a.state = 0;
+    e.feed(a, out);
+    a.ms = 5000;
+    a.state = 1;
+    int n = e.feed(a, out);
+    check(n == 2 && out[0].state == 0 && out[1].state == 1, "held close comes before the next open");
+}
+
+static void test_initial_level()
+{
+    // Door already open at boot
+    EdgeDebouncer d(HOLD_MS, 1);
+    SensorEvent ev = { 0, SENSOR_DOOR, 1 };
+    SensorEvent out[2];
+    check(d.feed(ev, out) == 0, "same level is not an edge");
+    ev.ms = 10;
+    ev.state = 0;
+    check(d.feed(ev, out) == 1 && out[0].state == 0, "first edge accepted at once");
+}
+
+int main()
+{
+    test_clean_edges();
+    test_bounce();
+    test_late_consumer();
+    test_settle();
+    test_initial_level();
+    return check_result();
+}
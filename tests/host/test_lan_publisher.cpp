@@ -0,0 +1,214 @@
+/*
+ * LAN path against a loopback stand-in for the hub: every message reaches
+ * the hub twice (cloud and LAN, in both orders) and must be kept once, the
+ * acks must give the latency, late or repeated acks must be ignored.
+ * Sequence numbers are only compared within one device and boot.
+ */
+#include "LanPublisher.h"
+#include "JsonPayload.h"
+#include "check.h"
+#include <thread>
+#include <chrono>
+
+#define MESSAGES 40
+
+static void test_seq_window()
+{
+    SeqWindow w;
+    check(!w.check_and_set(5), "first seq is new");
+    check(w.check_and_set(5), "same seq is seen");
+    check(!w.check_and_set(3), "older seq inside the window is new");
+    check(w.check_and_set(3), "older seq is seen the second time");
+    check(!w.check_and_set(40), "jump ahead is new");
+    check(!w.check_and_set(39), "seq just below the top is new");
+    check(w.check_and_set(40), "top is still seen after the jump");
+
+    // The sender restarted from 0: the window starts over
+    check(!w.check_and_set(0), "seq restarted far behind the top is new");
+    check(!w.check_and_set(1), "next seq after the restart is new");
+    check(w.check_and_set(0), "restarted seq is seen the second time");
+    check(!w.check_and_set(40), "old top is new again after the restart");
+}
+
+static void test_payload_fields()
+{
+    char device[LAN_DEVICE_SIZE];
+    uint32_t boot = 0;
+    const char* payload = "{ \"payload\": 1, \"device\": \"a\\\"b\", \"boot\": 77, \"seq\": 3 }";
+    check(lan_payload_device(payload, device, sizeof(device)) && strcmp(device, "a\\\"b") == 0,
+          "device read back, escaped quote included");
+    check(lan_payload_number(payload, "\"boot\": ", &boot) && boot == 77, "boot read back");
+    check(!lan_payload_device("{ \"device\": \"0123456789\" }", device, 8), "device too long");
+    check(!lan_payload_device("{ \"device\": \"abc", device, sizeof(device)), "unterminated device");
+}
+
+static void encode(EventPayload& payload, JsonBuffer<EVENT_PAYLOAD_SIZE>& buf, uint32_t seq)
+{
+    SensorEvent ev = { seq, SENSOR_DOOR, 1 };
+    payload.encode(buf, ev, seq, 1500000000 + seq, seq);
+}
+
+static void test_dedup_streams()
+{
+    EventPayload a1, a2, b;
+    a1.init("12345", "door-a", 1111);
+    a2.init("12345", "door-a", 2222);
+    b.init("12345", "door-b", 1111);
+    LanDedup dedup;
+
+    for (uint32_t seq = 0; seq < 50; seq++) {
+        JsonBuffer<EVENT_PAYLOAD_SIZE> buf;
+        encode(a1, buf, seq);
+        dedup.accept(buf.c_str());
+    }
+
+    // Two detectors with the same seq don't suppress each other
+    JsonBuffer<EVENT_PAYLOAD_SIZE> buf;
+    encode(b, buf, 10);
+    check(dedup.accept(buf.c_str()), "other device, same seq is kept");
+    check(!dedup.accept(buf.c_str()), "other device, second copy dropped");
+
+    // Cold boot: the seq restarts from 0 with a new boot id
+    for (uint32_t seq = 0; seq < 5; seq++) {
+        JsonBuffer<EVENT_PAYLOAD_SIZE> again;
+        encode(a2, again, seq);
+        check(dedup.accept(again.c_str()), "new boot, restarted seq is kept");
+        check(!dedup.accept(again.c_str()), "new boot, second copy dropped");
+    }
+
+    // The first boot is still told apart
+    JsonBuffer<EVENT_PAYLOAD_SIZE> old;
+    encode(a1, old, 49);
+    check(!dedup.accept(old.c_str()), "first boot, copy of a seen seq dropped");
+
+    // More streams than the table: the oldest one is forgotten, the others stay
+    for (uint32_t boot = 0; boot < LAN_DEDUP_STREAMS - 1; boot++) {
+        EventPayload p;
+        p.init("12345", "door-c", boot);
+        JsonBuffer<EVENT_PAYLOAD_SIZE> c;
+        encode(p, c, 0);
+        check(dedup.accept(c.c_str()), "new stream kept");
+    }
+    check(!dedup.accept(old.c_str()), "stream heard from recently is still known");
+    check(dedup.accept(buf.c_str()), "stream heard from the longest ago was forgotten");
+}
+
+static void test_payload_seq()
+{
+    EventPayload payload;
+    check(payload.init("12345", "dev\"seq\": 7", 1), "payload init");
+    JsonBuffer<EVENT_PAYLOAD_SIZE> buf;
+    SensorEvent ev = { 0, SENSOR_DOOR, 1 };
+    check(payload.encode(buf, ev, 4242, 1500000000, 10), "payload encode");
+    uint32_t seq = 0;
+    check(lan_payload_seq(buf.c_str(), &seq) && seq == 4242, "seq read back from the payload");
+    check(!lan_payload_seq("{ \"payload\": 1 }", &seq), "no seq in the payload");
+}
+
+// Hub side: one datagram in, dedup, ack to the sender
+static bool hub_receive(UDPSocket& hub, LanDedup& dedup, uint32_t& kept)
+{
+    char buf[EVENT_PAYLOAD_SIZE];
+    SocketAddress from;
+    nsapi_size_or_error_t n = hub.recvfrom(&from, buf, sizeof(buf) - 1);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    if (dedup.accept(buf)) {
+        kept++;
+    }
+    uint32_t seq;
+    if (lan_payload_seq(buf, &seq)) {
+        char ack[24];
+        int len = snprintf(ack, sizeof(ack), "ack %lu", (unsigned long)seq);
+        hub.sendto(from, ack, len);
+    }
+    return true;
+}
+
+// The ack travels through the loopback: poll until it lands or a second went by
+static void poll_until(LanPublisher& lan, uint32_t nowMs, uint32_t acked)
+{
+    for (int i = 0; i < 1000 && lan.acked_count() < acked; i++) {
+        lan.poll(nowMs);
+        if (lan.acked_count() < acked) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+static void test_loopback()
+{
+    NetworkInterface net;
+    UDPSocket hub;
+    check(hub.open(&net) == 0, "hub socket open");
+    check(hub.bind(SocketAddress("127.0.0.1", 0)) == 0, "hub socket bind");
+    hub.set_timeout(1000);
+
+    LanPublisher lan(&net, "127.0.0.1", hub.local_port());
+    check(lan.open() == 0, "publisher socket open");
+
+    EventPayload payload;
+    payload.init("12345", "door-1", 1);
+    LanDedup dedup;
+    uint32_t kept = 0;
+    uint32_t totalLatency = 0;
+
+    for (uint32_t seq = 1; seq <= MESSAGES; seq++) {
+        JsonBuffer<EVENT_PAYLOAD_SIZE> buf;
+        SensorEvent ev = { seq, SENSOR_DOOR, (uint8_t)(seq & 1) };
+        payload.encode(buf, ev, seq, 1500000000 + seq, seq);
+
+        // The cloud copy arrives before the LAN one for even seqs, after for odd ones
+        if (seq % 2 == 0 && dedup.accept(buf.c_str())) {
+            kept++;
+        }
+        uint32_t sentMs = seq * 100;
+        check(lan.publish(seq, buf.c_str(), buf.size(), sentMs) == 0, "LAN publish");
+        check(hub_receive(hub, dedup, kept), "hub receives the datagram");
+        if (seq % 2 == 1 && dedup.accept(buf.c_str())) {
+            kept++;
+        }
+
+        // Latency seen by the publisher: seq ms
+        poll_until(lan, sentMs + seq, seq);
+        check(lan.acked_count() == seq, "ack received");
+        check(lan.last_latency() == seq, "latency from the ack");
+        totalLatency += seq;
+    }
+
+    check(kept == MESSAGES, "hub keeps every message once");
+    check(dedup.duplicate_count() == MESSAGES, "hub drops every second copy");
+    check(lan.sent_count() == MESSAGES, "every message sent");
+    check(lan.max_latency() == MESSAGES, "max latency");
+    check(lan.avg_latency() == totalLatency / MESSAGES, "average latency");
+
+    // Repeated, late, unknown and malformed acks change nothing
+    SocketAddress publisher;
+    char probe[] = "probe";
+    check(lan.publish(MESSAGES + 1, probe, sizeof(probe) - 1, 0) == 0, "probe publish");
+    char buf[16];
+    check(hub.recvfrom(&publisher, buf, sizeof(buf)) > 0, "hub receives the probe");
+    const char* bad[] = { "ack 40", "ack 20", "ack 999", "hello" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        hub.sendto(publisher, bad[i], strlen(bad[i]));
+    }
+    // Then the good one: once it lands, all the bad ones were read too
+    char ack[] = "ack 41";
+    hub.sendto(publisher, ack, sizeof(ack) - 1);
+    poll_until(lan, 7, MESSAGES + 1);
+    check(lan.acked_count() == MESSAGES + 1, "only the expected ack counts");
+    check(lan.last_latency() == 7, "latency of the expected ack");
+}
+
+int main()
+{
+    test_seq_window();
+    test_payload_seq();
+    test_payload_fields();
+    test_dedup_streams();
+    test_loopback();
+
+    return check_result();
+}
@@ -0,0 +1,37 @@
+/*
+ * The firmware MQTTNetwork over the shim TLSSocket, without the MQTT
+ * library: connect() is bounded by the timeout given at construction,
+ * writes by the MQTT command timeout, and a read that times out is "no
+ * data" for the client.
+ */
+#include "MQTTNetwork.h"
+#include "check.h"
+
+#define CONNECT_TIMEOUT_MS 5000
+#define COMMAND_TIMEOUT_MS 1500
+
+int main()
+{
+    MockBroker& broker = MockBroker::get();
+    NetworkInterface iface;
+
+    MQTTNetwork unbounded(&iface);
+    check(unbounded.connect("broker", 8883) == 0, "connect without timeout");
+    check(broker.connect_timeout() == -1, "connect blocks by default");
+
+    MQTTNetwork network(&iface, CONNECT_TIMEOUT_MS);
+    check(network.connect("broker", 8883) == 0, "connect");
+    check(broker.connect_timeout() == CONNECT_TIMEOUT_MS, "connect bounded by the socket timeout");
+    // A reconnect gets a new socket, with the timeout again
+    check(network.connect("broker", 8883) == 0, "reconnect");
+    check(broker.connect_timeout() == CONNECT_TIMEOUT_MS, "reconnect bounded by the socket timeout");
+
+    unsigned char ping[] = { 0xC0, 0x00 };
+    check(network.write(ping, sizeof(ping), COMMAND_TIMEOUT_MS) == (int)sizeof(ping), "write");
+    check(broker.send_timeout() == COMMAND_TIMEOUT_MS, "write bounded by the command timeout");
+
+    unsigned char buf[4];
+    check(network.read(buf, sizeof(buf), 10) == 0, "read timed out without data is 0");
+
+    return check_result();
+}
@@ -0,0 +1,68 @@
+/*
+ * Stress test of SpscRing: a producer thread pushes millions of events while
+ * the consumer drains them, checking that nothing is reordered, duplicated
+ * or lost. A second pass checks that overflow is counted.
+ */
+#include "SensorEventRing.h"
+#include "check.h"
+#include <thread>
+
+#define EVENTS 5000000UL
+
+static SpscRing<SensorEvent, 32> ring;
+
+int main(int argc, char* argv[])
+{
+    uint32_t events = argc > 1 ? strtoul(argv[1], NULL, 10) : EVENTS;
+
+    // The producer waits for room, like interrupts coming at a finite rate,
+    // so every event must come out once and in order
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < events; i++) {
+            SensorEvent ev;
+            ev.ms = i;
+            ev.type = SENSOR_DOOR;
+            ev.state = i & 1;
+            while (ring.size() >= ring.capacity()) {
+                std::this_thread::yield();
+            }
+            if (!ring.push(ev)) {
+                check(false, "push failed with room in the ring");
+            }
+        }
+    });
+
+    uint32_t received = 0;
+    SensorEvent ev;
+    while (received < events) {
+        if (!ring.pop(ev)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (ev.ms != received || ev.state != (ev.ms & 1)) {
+            // Keep draining, or the producer would wait forever
+            check(false, "event out of order");
+        }
+        received++;
+    }
+    producer.join();
+
+    printf("%lu events received, max occupancy %lu/%lu\n", (unsigned long)received,
+           (unsigned long)ring.max_occupancy(), (unsigned long)ring.capacity());
+    check(!ring.pop(ev), "ring not empty at the end");
+    check(ring.dropped() == 0, "drops counted without overflow");
+    check(ring.max_occupancy() <= ring.capacity(), "occupancy over capacity");
+
+    // Overflow: without a consumer everything past the capacity is dropped
+    for (uint32_t i = 0; i < ring.capacity() + 10; i++) {
+        ev.ms = i;
+        ring.push_from_thread(ev);
+    }
+    check(ring.dropped() == 10, "overflow not counted");
+    for (uint32_t i = 0; i < ring.capacity(); i++) {
+        check(ring.pop(ev) && ev.ms == i, "oldest events not kept on overflow");
+    }
+    check(!ring.pop(ev), "dropped events were stored");
+
+    return check_result();
+}